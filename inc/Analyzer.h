@@ -0,0 +1,82 @@
+#ifndef __ANALYZER_H__
+#define __ANALYZER_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+
+#include "Controller.h"
+#include "Memory.h"
+
+#define RING_SIZE	65536	//root receive events in flight per thread, power of two
+#define CACHE_LINE	64
+#define MAX_RINGS	256	//threads receiving on the root
+
+/* What the root analysis needs from one receive */
+typedef struct {
+	long long lclk;		//root clock of the receive
+	int from;		//posted source, -1 for MPI_ANY_SOURCE
+	int src;		//actual source
+	long long recvlclk;	//clock piggybacked by the sender
+} RootEvent;
+
+/* Single-producer single-consumer ring of one thread receiving on the root */
+typedef struct {
+	RootEvent* events;
+	/* producer and consumer indices on their own cache lines */
+	char pad0[CACHE_LINE];
+	unsigned long long head;
+	char pad1[CACHE_LINE - sizeof(unsigned long long)];
+	unsigned long long tail;
+	char pad2[CACHE_LINE - sizeof(unsigned long long)];
+} EventRing;
+
+/* Root deadlock analysis, run inline on the receive path or on a helper thread.
+   Every receiving thread feeds the helper through its own ring, so the receive
+   path never takes a lock. Root clocks are dense : the helper merges the rings
+   by taking the events in clock order. */
+class Analyzer {
+private:
+	Controller* controller;
+	int rootProc;
+	FILE* file;
+
+	EventRing* rings[MAX_RINGS];
+	int numRings;			//rings the helper may read
+	int reservedRings;
+	long long nextClk;		//clock of the next event to analyze
+	int running;
+	pthread_t thread;
+
+	EventRing* localRing();
+
+	static void* run(void* arg);
+public:
+	Analyzer(Controller* controller, int rootProc, FILE* file);
+	~Analyzer();
+
+	void analyze(RootEvent* ev);
+
+	void start();
+
+	void push(RootEvent* ev);
+
+	void stop();
+
+};
+
+void initAnalyzer(Analyzer** analyzer, Controller* controller, int rootProc, FILE* file);
+
+void analyzeRootEvent(Analyzer* analyzer, long long lclk, int from, int src, long long recvlclk);
+
+void startAnalyzer(Analyzer* analyzer);
+
+void pushRootEvent(Analyzer* analyzer, long long lclk, int from, int src, long long recvlclk);
+
+void stopAnalyzer(Analyzer* analyzer);
+
+#endif /* __cplusplus */
+
+#endif /* __ANALYZER_H__ */
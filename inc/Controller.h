@@ -9,10 +9,11 @@
 #ifdef __cplusplus
 
 #include <vector>
-#include <map>
-#include <queue>
 
+#include "Log.h"
 #include "Process.h"
+#include "RecvWindow.h"
+#include "MinTree.h"
 
 
 using namespace std;
@@ -20,11 +21,16 @@ using namespace std;
 class Controller {
 private:
 	// map<int, RecvQueue> commProcs;
-	map<int, Process> commProcs;
-	vector<int> rootRecvs;
-	int increment;
+	vector<Process> commProcs;	//indexed by rank
+	MinTree preRemoves;		//min preRemove over all ranks, 0 while one is not initialized
+	RecvWindow rootRecvs;
+	int detected;			//deadlocks found so far
+
+	void setPreRemove(int rank, int clock);
+
+	void deadlock(Process& proc, int rc, int src, FILE* file);
 public:
-	Controller();
+	Controller(int nProc, int rootProc);
 	~Controller();
 
 	/*void insertRecv(int process, int clock);*/
@@ -37,15 +43,19 @@ public:
 
 	void printProcRecvs(int src);
 
+	int drainQueue(int rank, FILE* file);
+
 	void checkRemainQueue(int rank, FILE* file);
 
-	int minPreRemove(int nProc, int rootProc);
+	int deadlocks();
+
+	int minPreRemove();
 
 	void removeRootRecvs(int toIter);
 
 };
 
-void initController(Controller** controller);
+void initController(Controller** controller, int nProc, int rootProc);
 
 void addRootRecv(Controller* controller, int lclk, int from);
 
@@ -55,9 +65,13 @@ void manipulateCommProcs(Controller* controller, int src, int recvlclk, int lclk
 
 void printProcRecvs(Controller* controller, int src);
 
+int drainQueue(Controller* controller, int rank, FILE* file);
+
 void checkRemainQueue(Controller* controller, int rank, FILE *file);
 
-int minPreRemove(Controller* controller, int nProc, int rootProc);
+int deadlocksFound(Controller* controller);
+
+int minPreRemove(Controller* controller);
 
 void removeRootRecvs(Controller* controller, int toIter);
 
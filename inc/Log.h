@@ -0,0 +1,58 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "Memory.h"
+#include <stdarg.h>
+
+/* Log levels */
+#define LOG_ERROR	0
+#define LOG_INFO	1
+#define LOG_DEBUG	2	//one line per instrumented root receive
+#define LOG_TRACE	3	//loop pattern bookkeeping
+
+/* Levels above LOG_MAX_LEVEL are compiled out, their arguments are never evaluated */
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL	LOG_DEBUG
+#endif
+
+#define LOG_BUFFER	(1 << 20)	//bytes buffered per thread before a write
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+extern int logLevel;	//runtime level, DEADRACE_VERBOSE sets it
+
+void logWrite(const char* format, ...);
+
+void logFlush();
+
+#ifdef __cplusplus 
+}
+#endif /* __cplusplus */
+
+#define logAt(level, ...) do { if ((level) <= logLevel) logWrite(__VA_ARGS__); } while (0)
+
+#define logError(...)	logAt(LOG_ERROR, __VA_ARGS__)
+
+#if LOG_MAX_LEVEL >= LOG_INFO
+#define logInfo(...)	logAt(LOG_INFO, __VA_ARGS__)
+#else
+#define logInfo(...)	((void) 0)
+#endif
+
+#if LOG_MAX_LEVEL >= LOG_DEBUG
+#define logDebug(...)	logAt(LOG_DEBUG, __VA_ARGS__)
+#else
+#define logDebug(...)	((void) 0)
+#endif
+
+#if LOG_MAX_LEVEL >= LOG_TRACE
+#define logTrace(...)	logAt(LOG_TRACE, __VA_ARGS__)
+#else
+#define logTrace(...)	((void) 0)
+#endif
+
+#endif /* __LOG_H__ */
@@ -7,24 +7,60 @@
 
 #include <fstream>
 #include <iostream>
+#include <stdlib.h>
 
-#include "Iter.h"
+#include "Values.h"
+#include "Log.h"
+#include "Memory.h"
+#include "Trace.h"
 
 using namespace std;
 
+#define LOOP_MIN_BITS	4	//initial signature table is 1 << LOOP_MIN_BITS slots
+#define LOOP_FIELDS	6	//numSend numRecv sumSrc sumDest xorSrc xorDest
+
+/* Per-iteration leak check columns, as summary.c accumulates them */
+#define LEAK_SUMS	6	//numSend numRecv sumSrc sumDest sumRankSend sumRankRecv
+#define LEAK_XORS	2	//xorSrc xorDest
+
+/* Distinct communication patterns of a loop, stored as an arena of columns :
+   one array per signature field, pattern p at index p in insertion order,
+   and every iteration index in a shared append-only pool where each pattern
+   chains its own entries. The signature table maps a hash to p + 1. */
 class Loop {
 private:
-	Iter* head;
-	Iter* tail;
+	int* fields[LOOP_FIELDS];
+	int* first;		//first pool entry of each pattern
+	int* last;		//last pool entry of each pattern
+	int patterns;
+	int patternCap;
+
+	int* poolIter;		//iteration index of each pool entry
+	int* poolNext;		//next entry of the same pattern, -1 at the end
+	int poolSize;
+	int poolCap;
+
+	int* slots;
+	unsigned bits;
+
+	unsigned home(Values* values);
+	bool matchAt(int p, Values* values);
+	void grow();
+	void addPattern(Values* values);
+	void addIterCount(int p, int iter);
 public:
 	Loop();
 	~Loop();
 
-	void appendIter(Iter* iter, int rank);
+	void appendIter(int iter, Values* values, int rank);
 
 	void printLoop(const char* filename, int iter, double time, int rank);
 
-	void addIter(Iter* iter, int rank);
+	void writeLoop(const char* filename, int iter, double time, int rank);
+
+	void release();
+
+	void signatures(int numIters, int rank, int* sums, int* xors);
 
 	void print();
 
@@ -36,10 +72,18 @@ extern "C" {
 
 typedef struct Loop Loop;
 
-void appendIter(Loop* loop, Iter* iter, int rank);
+void createLoop(Loop** loop);
+
+void appendIter(Loop* loop, int iter, int nSend, int nRecv, int sSrc, int sDest, int xSrc, int xDest, int rank);
 
 void printLoop(Loop* loop, const char* filename, int iter, double time, int rank);
 
+void writeLoop(Loop* loop, const char* filename, int iter, double time, int rank);
+
+void releaseLoop(Loop* loop);
+
+void loopSignatures(Loop* loop, int numIters, int rank, int* sums, int* xors);
+
 #ifdef __cplusplus 
 }
 #endif /* __cplusplus */
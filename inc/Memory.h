@@ -5,14 +5,32 @@
 #include <stdlib.h>
 #include "string.h"
 
+#define MEM_SAMPLE	256	//root receives between two RSS samples, DEADRACE_MEM_SAMPLE overrides
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
-int parseLine(char* line);
+/* Accounting of the tool's own allocations, in bytes */
+void memAlloc(long long bytes);
+
+void memFree(long long bytes);
+
+long long toolMemory();
+
+long long peakToolMemory();
 
+/* Resident set size in KB, read from /proc/self/statm */
 int getMemory();
 
+void setMemorySampling(int events);
+
+int sampleMemory();
+
+int peakMemory();
+
+int peakAppMemory();
+
 void printMemory();
 
 #ifdef __cplusplus 
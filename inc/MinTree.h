@@ -0,0 +1,31 @@
+#ifndef __MINTREE_H__
+#define __MINTREE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#ifdef __cplusplus
+
+#include <vector>
+
+using namespace std;
+
+/* Tournament tree over one value per rank : O(log P) update, O(1) minimum */
+class MinTree {
+private:
+	vector<int> tree;	//tree[1] is the root, leaves start at tree[leaves]
+	int leaves;
+public:
+	MinTree(int n);
+	~MinTree();
+
+	void update(int i, int value);
+
+	int min() const { return tree[1]; }
+
+};
+
+#endif /* __cplusplus */
+
+#endif /* __MINTREE_H__ */
@@ -1,23 +1,30 @@
 #ifndef __MISC_H__
 #define __MISC_H__
 
-#include "Iter.h"
+#include "mpi.h"
 #include "Loop.h"
 
 
-/* Global Variable */
-/*extern int numSend;	//The number of Send Event on each process
-extern int numRecv;	//the number of Recv Event on each process
-extern int Drank;		//The rank of the current process
-extern int sumSrc;		//The xor(src) of all Recv Event on each process
-extern int xorSrc;		//The xor(src) of all Recv Event on all processes
-extern int sumDest;	//The xor(dest) of all Send Event on each process
-extern int xorDest;		//The xor(dest) of all Send Event on all processes 
-extern Loop *loop;
-extern Iter* iter;*/
-
 extern int enabled;
 
+/* Communication signature of the current iteration, updated by the PMPI wrappers.
+   Ranks are MPI_COMM_WORLD ranks so traces of all processes can be summed. */
+typedef struct {
+	int numSend;	//sends posted
+	int numRecv;	//receives completed
+	int sumSrc;	//sum of the sources of the receives
+	int sumDest;	//sum of the destinations of the sends
+	int xorSrc;	//xor of (source + rank) over the receives
+	int xorDest;	//xor of (rank + dest) over the sends
+	int active;	//inside beginFor / endFor
+} IterCounters;
+
+extern __thread IterCounters iterCnt;
+
+extern int leakOnline;	//check leaks at endFor instead of writing traces (DEADRACE_LEAK=online)
+
+extern int traceText;	//keep the old decimal trace format (DEADRACE_TRACE=text)
+
 void beginFor();
 void beginIter();
 void endIter(int i, int rank);
@@ -3,46 +3,304 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "mpi.h"
 
 #ifdef __cplusplus
 
 #include "Controller.h"
+#include "Analyzer.h"
 #include "Memory.h"
+#include "Pool.h"
+#include "Requests.h"
+#include "Misc.h"
 
-#define rootrecv	0
+#define rootrecv	0	//reports the verdicts, always a detection root
 
 /* Global Variable */
 int myrank;		//The rank of the current process
-int size;		//The number of processes
+int nprocs;		//The number of processes
 
 static Controller* controller;
 
-static int lclk = 0;
+static Analyzer* analyzer;	//root receive analysis
 
-int enabled = 0;
+int asyncAnalysis = 0;	//run the analysis on a helper thread (DEADRACE_ASYNC=1)
+
+int threaded = 0;	//MPI_THREAD_MULTIPLE : any thread may call MPI
+
+#define MAX_THREADS	256
+
+/* Staging buffers of the pack piggyback mode, one pool per calling thread */
+static __thread Pool* threadPool = NULL;
+
+static Pool* pools[MAX_THREADS];	//every thread's pool, for the statistics
+static int numPools = 0;
+static long long poolLimit;
+
+static RequestTable* reqTable;	//piggyback state of pending nonblocking operations
+
+#define POOL_LIMIT	64	//default MB kept idle in the pool, DEADRACE_POOL_LIMIT overrides
+
+/* Handle caches are per thread, so lookups never lock. Freeing a handle bumps a
+   generation that every thread's entries are checked against. */
+static unsigned typeGen = 1;
+static unsigned commGen = 1;
+
+/* Packed wire size (payload + clock) cache, direct mapped on (datatype, count) */
+#define PACK_CACHE	64
+
+typedef struct {
+	MPI_Datatype datatype;
+	int count;
+	int size;
+	unsigned gen;
+} PackSize;
+
+static __thread PackSize packCache[PACK_CACHE];
+
+/* MPI_COMM_WORLD ranks of a communicator's members, direct mapped on the handle */
+#define COMM_CACHE	16
+
+typedef struct {
+	MPI_Comm comm;
+	int inter;		//intercommunicator : ranks are the remote group's
+	int size;
+	int* ranks;
+	unsigned gen;
+} CommRanks;
+
+static __thread CommRanks commCache[COMM_CACHE];
+
+/* Matched probes : where a message handle came from, for the MPI_Mrecv or
+   MPI_Imrecv of the same thread that takes it */
+typedef struct {
+	MPI_Message message;
+	MPI_Comm comm;
+	int source;		//probed source, MPI_ANY_SOURCE for wildcard probes
+} Probed;
+
+#define PROBE_CACHE	16
+
+static __thread Probed probeCache[PROBE_CACHE];
 
-int maxMem = 0;
+/* Detection roots. Every rootStride-th rank (DEADRACE_ROOT_STRIDE, only rank 0
+   by default) analyzes its own receives with its own Controller. A root owns one
+   component of a vector clock and is the only one to increment it, so its
+   component is the largest of all. Messages carry every component. The receives
+   of the other ranks are not analyzed. */
+int rootStride;
+int numRoots = 1;
+int myRoot = -1;		//component of this rank, -1 if it is not a root
+int stampLen = 2;		//numRoots clocks, then the epoch
+
+static long long vclk[MAX_ROOTS];	//atomic : receiving threads merge into it, the root's increment its own
+
+/* Verdicts of every root summed up to rank 0 every checkpointEvery barriers on
+   MPI_COMM_WORLD (DEADRACE_CHECKPOINT), 0 : at MPI_Finalize only */
+int checkpointEvery = 0;
+static long long worldBarriers = 0;
+
+/* Lazy collective merges. A root's clock is the largest of all, so a collective
+   on MPI_COMM_WORLD that can only spread the roots' clocks, and that no rank can
+   leave before the roots entered it (barrier, all-to-all flows with non-empty
+   data from every member, non-empty bcast from a single root), just counts an
+   epoch on every rank, in the same order everywhere. Messages carry (clocks, epoch) and a root turns the
+   epoch back into its clock at that collective when a receive is analyzed.
+   With a single root, a merge toward it is dropped. */
+static long long epoch = 0;	//lazy collectives passed
+static long long knownEpoch = 0;	//latest one passed by this rank or anyone it heard from
+
+typedef struct {
+	long long epoch;
+	long long clk;
+} EpochClock;
+
+/* Root only : epochs where its clock changed, increasing. Entries never move, so
+   receiving threads search them without a lock while collectives append. */
+#define EPOCH_CHUNK	4096
+#define EPOCH_CHUNKS	1024
+
+static EpochClock* epochChunks[EPOCH_CHUNKS];	//this root's own component
+static int numEpochClocks = 0;
+
+/* Piggyback modes : how the local clock travels with a message */
+#define PB_DATATYPE	0	//clock and user buffer addressed by one struct datatype, payload never copied
+#define PB_PACK		1	//clock and payload packed into a staging buffer
+
+int pbMode = PB_DATATYPE;
+
+int enabled = 0;
 
 double cTime;
 
 FILE* fresult = NULL;
 
+/* Wrapped calls. Send flavours share one piggyback path, collectives are
+   generated from the COLLECTIVES table below. */
+#define SEND_CALLS(X)	X(Send) X(Ssend) X(Rsend) X(Bsend)
+
+#define ISEND_CALLS(X)	X(Isend) X(Issend) X(Irsend) X(Ibsend)
+
+#define PSEND_CALLS(X)	X(Send_init) X(Ssend_init) X(Bsend_init) X(Rsend_init)
+
+#define WRAPPED_CALLS(X) \
+	SEND_CALLS(X) ISEND_CALLS(X) PSEND_CALLS(X) X(Recv) X(Irecv) X(Recv_init) X(Mrecv) X(Imrecv) \
+	X(Sendrecv) X(Sendrecv_replace) X(Start) X(Startall) X(Probe) X(Iprobe) X(Mprobe) X(Improbe) \
+	X(Wait) X(Test) X(Waitall) X(Testall) X(Waitany) X(Testany) X(Waitsome) X(Testsome) \
+	X(Request_free) X(Barrier) X(Bcast)
+
+/* How data flows through a collective, so what the members' clocks must learn */
+#define FLOW_ALL	0	//every member hears from every member
+#define FLOW_TO_ROOT	1	//the root hears from every member
+#define FLOW_FROM_ROOT	2	//every member hears from the root
+#define FLOW_PREFIX	3	//a member hears from the lower ranks
+
+/* X(name, flow, parameters, arguments, root, synced). synced is non zero when MPI
+   cannot let this rank out before every member entered : it receives non-empty
+   data from each of them. Only those collectives on MPI_COMM_WORLD may be lazy. */
+#define COLLECTIVES(X) \
+	X(Reduce, FLOW_TO_ROOT, \
+		(const void *sendbuf, void *recvbuf, int count, MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm), \
+		(sendbuf, recvbuf, count, datatype, op, root, comm), root, 0) \
+	X(Allreduce, FLOW_ALL, \
+		(const void *sendbuf, void *recvbuf, int count, MPI_Datatype datatype, MPI_Op op, MPI_Comm comm), \
+		(sendbuf, recvbuf, count, datatype, op, comm), 0, hasData(count, datatype)) \
+	X(Allgather, FLOW_ALL, \
+		(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm), \
+		(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm), 0, hasData(recvcount, recvtype)) \
+	X(Allgatherv, FLOW_ALL, \
+		(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, const int recvcounts[], const int displs[], MPI_Datatype recvtype, MPI_Comm comm), \
+		(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, comm), 0, 0) \
+	X(Alltoall, FLOW_ALL, \
+		(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm), \
+		(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm), 0, hasData(recvcount, recvtype)) \
+	X(Alltoallv, FLOW_ALL, \
+		(const void *sendbuf, const int sendcounts[], const int sdispls[], MPI_Datatype sendtype, void *recvbuf, const int recvcounts[], const int rdispls[], MPI_Datatype recvtype, MPI_Comm comm), \
+		(sendbuf, sendcounts, sdispls, sendtype, recvbuf, recvcounts, rdispls, recvtype, comm), 0, 0) \
+	X(Alltoallw, FLOW_ALL, \
+		(const void *sendbuf, const int sendcounts[], const int sdispls[], const MPI_Datatype sendtypes[], void *recvbuf, const int recvcounts[], const int rdispls[], const MPI_Datatype recvtypes[], MPI_Comm comm), \
+		(sendbuf, sendcounts, sdispls, sendtypes, recvbuf, recvcounts, rdispls, recvtypes, comm), 0, 0) \
+	X(Reduce_scatter, FLOW_ALL, \
+		(const void *sendbuf, void *recvbuf, const int recvcounts[], MPI_Datatype datatype, MPI_Op op, MPI_Comm comm), \
+		(sendbuf, recvbuf, recvcounts, datatype, op, comm), 0, 0) \
+	X(Reduce_scatter_block, FLOW_ALL, \
+		(const void *sendbuf, void *recvbuf, int recvcount, MPI_Datatype datatype, MPI_Op op, MPI_Comm comm), \
+		(sendbuf, recvbuf, recvcount, datatype, op, comm), 0, hasData(recvcount, datatype)) \
+	X(Gather, FLOW_TO_ROOT, \
+		(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm), \
+		(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm), root, 0) \
+	X(Gatherv, FLOW_TO_ROOT, \
+		(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, const int recvcounts[], const int displs[], MPI_Datatype recvtype, int root, MPI_Comm comm), \
+		(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, root, comm), root, 0) \
+	X(Scatter, FLOW_FROM_ROOT, \
+		(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm), \
+		(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm), root, 0) \
+	X(Scatterv, FLOW_FROM_ROOT, \
+		(const void *sendbuf, const int sendcounts[], const int displs[], MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm), \
+		(sendbuf, sendcounts, displs, sendtype, recvbuf, recvcount, recvtype, root, comm), root, 0) \
+	X(Scan, FLOW_PREFIX, \
+		(const void *sendbuf, void *recvbuf, int count, MPI_Datatype datatype, MPI_Op op, MPI_Comm comm), \
+		(sendbuf, recvbuf, count, datatype, op, comm), 0, 0) \
+	X(Exscan, FLOW_PREFIX, \
+		(const void *sendbuf, void *recvbuf, int count, MPI_Datatype datatype, MPI_Op op, MPI_Comm comm), \
+		(sendbuf, recvbuf, count, datatype, op, comm), 0, 0)
+
+/* Calls made by the application, per kind, summed over the ranks at MPI_Finalize */
+#define CALL_KIND(name)	CALL_##name,
+#define COLLECTIVE_KIND(name, flow, params, args, root, synced)	CALL_##name,
+
+enum {
+	WRAPPED_CALLS(CALL_KIND)
+	COLLECTIVES(COLLECTIVE_KIND)
+	CALL_KINDS
+};
+
+#define CALL_NAME(name)	#name,
+#define COLLECTIVE_NAME(name, flow, params, args, root, synced)	#name,
+
+static const char* callNames[CALL_KINDS] = {
+	WRAPPED_CALLS(CALL_NAME)
+	COLLECTIVES(COLLECTIVE_NAME)
+};
+
+static long long callCount[CALL_KINDS];
+
+/* Application threads call in concurrently under MPI_THREAD_MULTIPLE */
+#define COUNT_CALL(kind)	__atomic_fetch_add(&callCount[kind], 1, __ATOMIC_RELAXED)
+
 extern int MPI_Init(int *argc, char ***argv);
 
-extern int MPI_Send(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm);
+extern int MPI_Init_thread(int *argc, char ***argv, int required, int *provided);
+
+#define SEND_EXTERN(name) \
+extern int MPI_##name(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm);
+
+SEND_CALLS(SEND_EXTERN)
+
+#define ISEND_EXTERN(name) \
+extern int MPI_##name(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm, MPI_Request *request);
 
-/*extern int MPI_Isend(void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm, MPI_Request *request);*/
+ISEND_CALLS(ISEND_EXTERN)
+
+PSEND_CALLS(ISEND_EXTERN)
 
 extern int MPI_Recv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Status *status);
 
-// extern int MPI_Irecv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Request *request);
+extern int MPI_Irecv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Request *request);
+
+extern int MPI_Recv_init(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Request *request);
+
+extern int MPI_Start(MPI_Request *request);
+
+extern int MPI_Startall(int count, MPI_Request array_of_requests[]);
+
+extern int MPI_Probe(int source, int tag, MPI_Comm comm, MPI_Status *status);
+
+extern int MPI_Iprobe(int source, int tag, MPI_Comm comm, int *flag, MPI_Status *status);
+
+extern int MPI_Mprobe(int source, int tag, MPI_Comm comm, MPI_Message *message, MPI_Status *status);
+
+extern int MPI_Improbe(int source, int tag, MPI_Comm comm, int *flag, MPI_Message *message, MPI_Status *status);
+
+extern int MPI_Mrecv(void *buf, int count, MPI_Datatype datatype, MPI_Message *message, MPI_Status *status);
+
+extern int MPI_Imrecv(void *buf, int count, MPI_Datatype datatype, MPI_Message *message, MPI_Request *request);
+
+extern int MPI_Sendrecv(const void *sendbuf, int sendcount, MPI_Datatype sendtype, int dest, int sendtag, void *recvbuf, int recvcount, MPI_Datatype recvtype, int source, int recvtag, MPI_Comm comm, MPI_Status *status);
+
+extern int MPI_Sendrecv_replace(void *buf, int count, MPI_Datatype datatype, int dest, int sendtag, int source, int recvtag, MPI_Comm comm, MPI_Status *status);
+
+extern int MPI_Wait(MPI_Request *request, MPI_Status *status);
+
+extern int MPI_Test(MPI_Request *request, int *flag, MPI_Status *status);
+
+extern int MPI_Waitall(int count, MPI_Request array_of_requests[], MPI_Status array_of_statuses[]);
+
+extern int MPI_Testall(int count, MPI_Request array_of_requests[], int *flag, MPI_Status array_of_statuses[]);
+
+extern int MPI_Waitany(int count, MPI_Request array_of_requests[], int *index, MPI_Status *status);
+
+extern int MPI_Testany(int count, MPI_Request array_of_requests[], int *index, int *flag, MPI_Status *status);
+
+extern int MPI_Waitsome(int incount, MPI_Request array_of_requests[], int *outcount, int array_of_indices[], MPI_Status array_of_statuses[]);
+
+extern int MPI_Testsome(int incount, MPI_Request array_of_requests[], int *outcount, int array_of_indices[], MPI_Status array_of_statuses[]);
+
+extern int MPI_Request_free(MPI_Request *request);
 
 extern int MPI_Barrier(MPI_Comm comm);
 
 extern int MPI_Bcast(void *buffer, int count, MPI_Datatype datatype, int root, MPI_Comm comm);
 
-extern int MPI_Reduce(void *sendbuf, void *recvbuf, int count, MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm);
+#define COLLECTIVE_EXTERN(name, flow, params, args, root, synced) \
+extern int MPI_##name params;
+
+COLLECTIVES(COLLECTIVE_EXTERN)
+
+extern int MPI_Type_free(MPI_Datatype *datatype);
+
+extern int MPI_Comm_free(MPI_Comm *comm);
 
 extern int MPI_Finalize();
 
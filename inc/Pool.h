@@ -0,0 +1,64 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "Memory.h"
+
+#ifdef __cplusplus
+
+#include <pthread.h>
+
+#define POOL_MIN_SHIFT	6	//smallest size class : 64 B
+#define POOL_MAX_SHIFT	26	//largest size class : 64 MB, bigger buffers bypass the pool
+#define POOL_CLASSES	(POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+
+/* Hidden header in front of every buffer handed out by the pool */
+typedef struct PoolHeader {
+	struct PoolHeader* next;
+	int cls;		//size class, -1 when allocated outside the pool
+	int size;		//requested size
+} PoolHeader;
+
+/* Per-thread pool of staging buffers, one free list per power-of-two size class.
+   Only the thread that made it acquires from it : a buffer released by another
+   thread waits on the remote list until the owner takes it back. */
+class Pool {
+private:
+	PoolHeader* freeLists[POOL_CLASSES];
+	PoolHeader* remote;	//released by other threads, lock-free stack
+	pthread_t owner;
+	long long limit;	//max bytes kept idle in the free lists
+	long long cached;	//bytes currently idle in the free lists
+	long long footprint;	//bytes currently allocated by the pool (in use + idle)
+	long long peak;
+	long long gets;
+	long long hits;
+
+	void reclaim();
+public:
+	Pool(long long limit);
+	~Pool();
+
+	char* acquire(int size);
+
+	void release(char* buf);
+
+	long long getGets();
+	long long getHits();
+	long long getPeak();
+
+};
+
+void initPool(Pool** pool, long long limit);
+
+char* poolAcquire(Pool* pool, int size);
+
+void poolRelease(Pool* pool, char* buf);
+
+/* stats[0] = acquires, stats[1] = free list hits, stats[2] = peak footprint in bytes */
+void poolStats(Pool* pool, long long* stats);
+
+#endif /* __cplusplus */
+
+#endif /* __POOL_H__ */
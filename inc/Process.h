@@ -3,13 +3,15 @@
 
 #ifdef __cplusplus
 
-#include <queue>
+#include "RecvRanges.h"
 
 using namespace std;
 
-typedef queue<int> RecvQueue;
+/* candidate root receives of a process, kept as runs of clocks */
+typedef RecvRanges RecvQueue;
 
 typedef struct {
+	int initialized;	//a message from this process reached the root
 	int noDlks;
 	int preRemove;
 	RecvQueue priorRecvs;
@@ -0,0 +1,45 @@
+#ifndef __RECVRANGES_H__
+#define __RECVRANGES_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "Memory.h"
+
+#ifdef __cplusplus
+
+#include <deque>
+
+using namespace std;
+
+/* Run of consecutive candidate receive clocks */
+typedef struct {
+	int lo;
+	int hi;
+} ClockRange;
+
+/* FIFO of increasing receive clocks stored as runs : a stream of wildcard
+   receives costs one range instead of one entry per receive */
+class RecvRanges {
+private:
+	deque<ClockRange> ranges;
+public:
+	RecvRanges();
+	~RecvRanges();
+
+	void push(int clock);
+
+	void pop();
+
+	int front() const { return ranges.front().lo; }
+
+	int back() const { return ranges.back().hi; }
+
+	bool empty() const { return ranges.empty(); }
+
+	unsigned runs() const { return ranges.size(); }
+
+};
+
+#endif /* __cplusplus */
+
+#endif /* __RECVRANGES_H__ */
@@ -0,0 +1,50 @@
+#ifndef __RECVWINDOW_H__
+#define __RECVWINDOW_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "Memory.h"
+
+#ifdef __cplusplus
+
+#include <deque>
+
+using namespace std;
+
+#define WINDOW_SHIFT	12
+#define WINDOW_CHUNK	(1 << WINDOW_SHIFT)	//receives per chunk
+
+/* Posted source of every root receive still of interest, indexed by the absolute
+   receive clock (1-based). Appending and dropping a prefix are O(1) amortized :
+   chunks are released whole and no element is ever shifted. */
+class RecvWindow {
+private:
+	deque<int*> chunks;
+	int base;		//clock of the first slot of chunks.front()
+	int first;		//first clock retained
+	int next;		//clock of the next append
+	int* spare;		//one released chunk kept for reuse
+public:
+	RecvWindow();
+	~RecvWindow();
+
+	void append(int from);
+
+	int at(int clock) const {
+		int off = clock - base;
+		return chunks[off >> WINDOW_SHIFT][off & (WINDOW_CHUNK - 1)];
+	}
+
+	void dropTo(int clock);
+
+	int begin() const { return first; }
+
+	int end() const { return next; }
+
+	int size() const { return next - first; }
+
+};
+
+#endif /* __cplusplus */
+
+#endif /* __RECVWINDOW_H__ */
@@ -0,0 +1,108 @@
+#ifndef __REQUESTS_H__
+#define __REQUESTS_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "Memory.h"
+#include "Pool.h"
+#include "mpi.h"
+
+#ifdef __cplusplus
+
+#include <vector>
+#include <pthread.h>
+
+using namespace std;
+
+#define REQ_SEND	0
+#define REQ_RECV	1
+
+#define REQ_CHUNK	256	//pending records allocated at a time
+
+#define MAX_ROOTS	64	//detection roots, one clock each
+#define MAX_STAMP	(MAX_ROOTS + 1)	//piggybacked words : a clock per root, collective epoch
+
+/* Piggyback state of a nonblocking operation, kept until MPI_Wait* / MPI_Test* completes it,
+   or until MPI_Request_free for a persistent one.
+   Records never move once allocated : MPI may write the clock into them at any time. */
+typedef struct PendingReq {
+	MPI_Request request;
+	int kind;
+	int source;		//posted source, MPI_ANY_SOURCE for wildcard receives, destination of a send
+	void* buf;
+	int count;
+	MPI_Datatype datatype;
+	MPI_Comm comm;
+	MPI_Datatype ptype;	//clock + payload struct type, MPI_DATATYPE_NULL in pack mode
+	char* packbuf;		//staging buffer in pack mode
+	Pool* pool;		//pool of the thread that acquired packbuf
+	int packsize;
+	long long stamp[MAX_STAMP];	//clocks and epoch sent, or received
+	int persistent;		//MPI_*_init : MPI_Start uses the record again
+	int active;		//persistent : started, not completed yet
+	struct PendingReq* next;	//free list link
+} PendingReq;
+
+/* MPI_Request -> PendingReq hash table, open addressing with linear probing.
+   Only operations still in flight are kept : MPI libraries may hand out one
+   shared handle for operations that completed immediately, so those never
+   enter the table. */
+class RequestTable {
+private:
+	PendingReq** slots;
+	unsigned bits;
+	unsigned used;
+	vector<PendingReq*> chunks;
+	PendingReq* freeList;
+	int shared;		//MPI_THREAD_MULTIPLE : table ops are locked, free records are per thread
+	pthread_mutex_t mutex;
+
+	unsigned home(MPI_Request request);
+	void grow();
+public:
+	RequestTable();
+	~RequestTable();
+
+	PendingReq* create();
+
+	void insert(PendingReq* pr);
+
+	PendingReq* find(MPI_Request request);
+
+	void remove(PendingReq* pr);
+
+	void detach(PendingReq* pr);
+
+	void recycle(PendingReq* pr);
+
+	unsigned pending();
+
+	void share();
+
+	void lock();
+
+	void unlock();
+
+};
+
+void initRequests(RequestTable** table);
+
+PendingReq* createRequest(RequestTable* table);
+
+void insertRequest(RequestTable* table, PendingReq* pr);
+
+PendingReq* findRequest(RequestTable* table, MPI_Request request);
+
+void removeRequest(RequestTable* table, PendingReq* pr);
+
+void detachRequest(RequestTable* table, PendingReq* pr);
+
+void recycleRequest(RequestTable* table, PendingReq* pr);
+
+unsigned pendingRequests(RequestTable* table);
+
+void shareRequests(RequestTable* table);
+
+#endif /* __cplusplus */
+
+#endif /* __REQUESTS_H__ */
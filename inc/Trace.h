@@ -0,0 +1,104 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Binary loop trace, one file per rank, every integer little-endian.
+
+   file header   : magic u32, version u32, rank i32, reserved u32
+   loop block    : numIters i32, patterns i32, time f64, listBytes u32, reserved u32
+                   TRACE_FIELDS columns of patterns i32 each (numSend numRecv sumSrc
+                   sumDest xorSrc xorDest), then listBytes of iteration lists : per
+                   pattern a varint count followed by zigzag varint deltas
+
+   Loop blocks are appended by every endFor. Readers must check the version.
+
+   The reader maps the file and walks it in place, binary or the older decimal
+   text format ("[numIters]", then per pattern "( i j ... )" and six lines of
+   fields, "!time" at the end of a loop) : loops, then patterns, then iterations,
+   with no allocation. */
+
+#define TRACE_MAGIC		0x52544444	//"DDTR"
+#define TRACE_VERSION		1
+#define TRACE_FIELDS		6
+#define TRACE_HEADER		16
+#define TRACE_LOOP_HEADER	24
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* Growable output buffer, written with a single write() */
+typedef struct {
+	unsigned char* data;
+	size_t len;
+	size_t cap;
+} TraceBuf;
+
+void tracePutU32(TraceBuf* tb, unsigned v);
+
+void tracePutF64(TraceBuf* tb, double v);
+
+void tracePutVarint(TraceBuf* tb, unsigned long long v);
+
+void tracePutDelta(TraceBuf* tb, int delta);
+
+void tracePatchU32(TraceBuf* tb, size_t at, unsigned v);
+
+size_t traceBeginLoop(TraceBuf* tb, int numIters, int patterns, double time);
+
+void traceEndLoop(TraceBuf* tb, size_t loopStart, size_t listStart);
+
+int traceAppend(TraceBuf* tb, const char* filename, int rank);
+
+void traceFree(TraceBuf* tb);
+
+/* Reader */
+typedef struct {
+	const unsigned char* data;	//the mapped file
+	size_t size;
+	size_t pos;
+	int text;			//decimal text trace
+	int version;
+	int rank;
+} TraceFile;
+
+typedef struct {
+	int numIters;
+	int patterns;			//-1 in a text trace, known once read
+	double time;
+	const unsigned char* cols;
+	const unsigned char* list;	//cursor in the iteration lists, or in the text
+	const unsigned char* end;
+	int next;			//next pattern to read
+	int left;			//iterations of the current pattern not read yet
+	int prev;			//last iteration read, deltas are taken from it
+	TraceFile* file;
+} TraceLoop;
+
+typedef struct {
+	int fields[TRACE_FIELDS];
+	int count;			//iterations in the list, -1 in a text trace
+	TraceLoop* loop;
+	const unsigned char* iter;	//text : cursor in the "( i j ... )" line
+	const unsigned char* iterEnd;
+} TracePattern;
+
+/* 0 : binary trace, 1 : text trace, -1 : unreadable or unknown version */
+int traceOpen(TraceFile* tf, const char* filename);
+
+void traceClose(TraceFile* tf);
+
+/* 1 : a loop was read, 0 : end of file, -1 : truncated or corrupt */
+int traceNextLoop(TraceFile* tf, TraceLoop* tl);
+
+int traceNextPattern(TraceLoop* tl, TracePattern* tp);
+
+int traceNextIter(TracePattern* tp, int* iter);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __TRACE_H__ */
@@ -28,6 +28,7 @@ public:
 	int getXorSrc();
 	int getXorDest();
 	bool match(Values* other);
+	unsigned long long hash();
 
 	string toString();
 
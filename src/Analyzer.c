@@ -0,0 +1,158 @@
+#include "Analyzer.h"
+
+#include <sched.h>
+#include <unistd.h>
+
+Analyzer::Analyzer(Controller* controller, int rootProc, FILE* file):
+controller(controller),
+rootProc(rootProc),
+file(file),
+numRings(0),
+reservedRings(0),
+nextClk(1),
+running(0)
+{}
+
+Analyzer::~Analyzer() {
+	for (int i = 0; i < numRings; i++) {
+		memFree(RING_SIZE * sizeof(RootEvent) + sizeof(EventRing));
+		free(rings[i]->events);
+		free(rings[i]);
+	}
+}
+
+/* The ring of the calling thread, registered on its first receive */
+static __thread EventRing* threadRing = NULL;
+
+void Analyzer::analyze(RootEvent* ev) {
+	logDebug("\nProcess %i (recv) : source = %i lclk = %lld recvlclk = %lld src = %i ", rootProc, ev->from, ev->lclk, ev->recvlclk, ev->src);
+	int minPreRm;
+	if (ev->lclk % 100 == 0) {
+		minPreRm = controller->minPreRemove();
+		logDebug(" minPreRemove = %i ", minPreRm);
+		controller->removeRootRecvs(minPreRm);
+	}
+	// add to root receiving list
+	controller->addRootRecv(ev->lclk, ev->from);
+
+	// compare local clock and receiving clock
+
+		// add appropriate receiving local clock to src-process queue & remove inappropriate receiving local clock
+
+		// remove selected receiving local clock for current receving event
+	controller->manipulateCommProcs(ev->src, ev->recvlclk, ev->lclk, file);
+
+	//printProcRecvs(controller, src);
+
+	// RSS is only read every few receives, the peaks are kept by Memory
+	int tempMem = sampleMemory();
+	if (tempMem >= 0)
+		logDebug("%i KB ", tempMem);
+	logDebug("\n");
+}
+
+void* Analyzer::run(void* arg) {
+	Analyzer* self = (Analyzer*) arg;
+	int idle = 0;
+	int r = 0;		//ring the last event came from, the next one is likely there too
+	while (true) {
+		int n = __atomic_load_n(&self->numRings, __ATOMIC_ACQUIRE);
+		int found = 0;
+		int pending = 0;
+		for (int k = 0; k < n && !found; k++) {
+			int i = (r + k) % n;
+			EventRing* ring = self->rings[i];
+			unsigned long long t = ring->tail;
+			if (t == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) continue;
+			pending = 1;
+			RootEvent* ev = &ring->events[t & (RING_SIZE - 1)];
+			if (ev->lclk != self->nextClk) continue;
+			self->analyze(ev);
+			self->nextClk++;
+			__atomic_store_n(&ring->tail, t + 1, __ATOMIC_RELEASE);
+			found = 1;
+			r = i;
+		}
+		if (found) {
+			idle = 0;
+			continue;
+		}
+		/* nothing to do : leave once the receive side is done and drained */
+		if (!pending && !__atomic_load_n(&self->running, __ATOMIC_ACQUIRE) &&
+			n == __atomic_load_n(&self->numRings, __ATOMIC_ACQUIRE)) {
+			int empty = 1;
+			for (int i = 0; i < n; i++)
+				empty &= (self->rings[i]->tail == __atomic_load_n(&self->rings[i]->head, __ATOMIC_ACQUIRE));
+			if (empty) break;
+		}
+		if (++idle < 64)
+			sched_yield();
+		else
+			usleep(50);
+	}
+	logFlush();
+	return NULL;
+}
+
+void Analyzer::start() {
+	running = 1;
+	pthread_create(&thread, NULL, Analyzer::run, this);
+}
+
+EventRing* Analyzer::localRing() {
+	if (threadRing == NULL) {
+		int i = __atomic_fetch_add(&reservedRings, 1, __ATOMIC_RELAXED);
+		if (i >= MAX_RINGS) {
+			fprintf(stderr, "deadrace : more than %d threads receive on the root\n", MAX_RINGS);
+			abort();
+		}
+		EventRing* ring = (EventRing*) calloc(1, sizeof(EventRing));
+		ring->events = (RootEvent*) malloc(RING_SIZE * sizeof(RootEvent));
+		memAlloc(RING_SIZE * sizeof(RootEvent) + sizeof(EventRing));
+		rings[i] = ring;
+		/* rings are published in slot order, the helper reads rings[0, numRings) */
+		while (__atomic_load_n(&numRings, __ATOMIC_ACQUIRE) != i)
+			sched_yield();
+		__atomic_store_n(&numRings, i + 1, __ATOMIC_RELEASE);
+		threadRing = ring;
+	}
+	return threadRing;
+}
+
+void Analyzer::push(RootEvent* ev) {
+	EventRing* ring = localRing();
+	unsigned long long h = ring->head;
+	/* ring full : the receive path waits for the helper rather than dropping events */
+	while (h - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_SIZE)
+		sched_yield();
+	ring->events[h & (RING_SIZE - 1)] = *ev;
+	__atomic_store_n(&ring->head, h + 1, __ATOMIC_RELEASE);
+}
+
+void Analyzer::stop() {
+	if (!running) return;
+	__atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+	pthread_join(thread, NULL);
+}
+
+void initAnalyzer(Analyzer** analyzer, Controller* controller, int rootProc, FILE* file) {
+	(*analyzer) = new Analyzer(controller, rootProc, file);
+}
+
+void analyzeRootEvent(Analyzer* analyzer, long long lclk, int from, int src, long long recvlclk) {
+	RootEvent ev = {lclk, from, src, recvlclk};
+	analyzer->analyze(&ev);
+}
+
+void startAnalyzer(Analyzer* analyzer) {
+	analyzer->start();
+}
+
+void pushRootEvent(Analyzer* analyzer, long long lclk, int from, int src, long long recvlclk) {
+	RootEvent ev = {lclk, from, src, recvlclk};
+	analyzer->push(&ev);
+}
+
+void stopAnalyzer(Analyzer* analyzer) {
+	analyzer->stop();
+}
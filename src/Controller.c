@@ -1,7 +1,16 @@
 #include "Controller.h"
 
-Controller::Controller() {
-	increment = 0;
+Controller::Controller(int nProc, int rootProc):
+commProcs(nProc),
+preRemoves(nProc),
+detected(0)
+{
+	for (int i = 0; i < nProc; i++) {
+		commProcs[i].initialized = 0;
+		/* the root never sends to itself, it must not hold the minimum back */
+		if (i != rootProc)
+			preRemoves.update(i, 0);
+	}
 }
 
 Controller::~Controller() {}
@@ -23,25 +32,41 @@ Controller::~Controller() {}
 }*/
 
 void Controller::addRootRecv(int lclk, int from) {
-	rootRecvs.push_back(from);
+	rootRecvs.append(from);
 }
 
 void Controller::printRootRecvs() {
 	printf("\nRoot Receiving List Remains: ");
-	for(unsigned i = 0; i < rootRecvs.size(); i++) {
-		printf("\n%i ", i+1+increment);
-		(rootRecvs[i] == -1) ? printf("MPI_ANY_SOURCE") : printf("%i", rootRecvs[i]);
+	for(int c = rootRecvs.begin(); c < rootRecvs.end(); c++) {
+		printf("\n%i ", c);
+		(rootRecvs.at(c) == -1) ? printf("MPI_ANY_SOURCE") : printf("%i", rootRecvs.at(c));
 	}
 }
 
+/* A receive of the root that src can no longer match */
+void Controller::deadlock(Process& proc, int rc, int src, FILE* file) {
+	fprintf(file, "Deadlock happens at RC = %i , RECV( %i )\n", rc, src);
+	logDebug(" Deadlock ");
+	proc.noDlks++;
+	// read by checkpoints while the helper thread analyzes
+	__atomic_add_fetch(&detected, 1, __ATOMIC_RELAXED);
+}
+
+int Controller::deadlocks() {
+	return __atomic_load_n(&detected, __ATOMIC_RELAXED);
+}
+
+void Controller::setPreRemove(int rank, int clock) {
+	commProcs[rank].preRemove = clock;
+	preRemoves.update(rank, clock);
+}
+
 void Controller::printProcRecvs(int src) {
-	map<int, Process>::iterator it = commProcs.find(src);
-	// map<int, RecvQueue >::iterator it = commProcs.find(src);
-	if (it == commProcs.end()) {
+	if (!commProcs[src].initialized) {
 		printf("\nReceiving queue of process %i has not been initialized", src);
 	} else {
 		// Process pqueue = it->second;
-		RecvQueue pqueue = it->second.priorRecvs;
+		RecvQueue& pqueue = commProcs[src].priorRecvs;
 		// queue<int> tmpqueue = it->second.priorRecvs;
 		// int tmp;
 		printf("\nProcess %i : ", src);
@@ -55,95 +80,78 @@ void Controller::printProcRecvs(int src) {
 	}
 }
 
-int Controller::minPreRemove(int nProc, int rootProc) {
+int Controller::minPreRemove() {
 	/* 0 : there is a process not initialized 
-	   > 0 : min receiving iterator */
-	int min = -1;
-	map<int, Process >::iterator it;
-	for (int i = 0; i < nProc; i++) {
-		if (i != rootProc) {
-			/*printf(" i = %i",i);*/
-			it = commProcs.find(i);
-			if (it == commProcs.end()) return 0; 
-			if (min < 0) {
-				min = it->second.preRemove;
-				/*printf("min < 0");*/
-			}
-			else {
-				min = (it->second.preRemove < min) ? it->second.preRemove : min; 
-				/*printf("min > 0");*/
-			}
-		}
-	}
-	return min;
+	   > 0 : min receiving iterator
+	   -1 : no process but the root */
+	int min = preRemoves.min();
+	return (min == INT_MAX) ? -1 : min;
 }
 
 void Controller::manipulateCommProcs(int src, int recvlclk, int lclk, FILE* file) {
 	// Process pqueue;
-	RecvQueue recvs;
-	unsigned i;
-	// map<int, RecvQueue >::iterator it = commProcs.find(src);
-	map<int, Process >::iterator it = commProcs.find(src);
-	if (it == commProcs.end()) {
+	int c;
+	Process& proc = commProcs[src];
+	if (!proc.initialized) {
 		// receiving queue of src process have not been initialized
 
 		// add receiving queue of src process into map
 		// int first = 0;
 		/*printf("not initalized");*/
-		Process pqueue;
-		for (i = recvlclk; i < lclk; i++) {
-			if (rootRecvs[i-increment] == -1 || rootRecvs[i-increment] == src) {
+		// the queue is built in place, never copied
+		Process& pqueue = proc;
+		RecvQueue& recvs = pqueue.priorRecvs;
+		for (c = recvlclk + 1; c <= lclk; c++) {
+			if (rootRecvs.at(c) == -1 || rootRecvs.at(c) == src) {
 				/*if (first == 0) {
 					first = 1;	
 				} else {
-					pqueue.priorRecvs.push(i+1);
+					pqueue.priorRecvs.push(c);
 				}*/
-				// pqueue.priorRecvs.push(i+1);
-				recvs.push(i+1);
+				// pqueue.priorRecvs.push(c);
+				recvs.push(c);
 			}
 		}
 		/*printf("[front = %i back = %i] ", recvs.front(), recvs.back());*/
 		// pqueue.priorRecvs.pop();
-		pqueue.preRemove = recvs.front();
+		setPreRemove(src, recvs.front());
 		recvs.pop();
 		/*printf("[front = %i back = %i] ", recvs.front(), recvs.back());*/
-		if (recvs.empty()) printf(" Empty!!! ");
+		if (recvs.empty()) logDebug(" Empty!!! ");
 		
-		pqueue.priorRecvs = recvs;
 		pqueue.noDlks = 0;
+		pqueue.initialized = 1;
 		// pqueue.preRemove = 0;
-		commProcs.insert(pair<int, Process>(src, pqueue));
-		// commProcs.insert(pair<int, RecvQueue >(src, recvs));
 	} else {
 		/*printf("initialized");*/
 		// receiving queue of src process have been initialized
 		// pqueue = it->second;
 		// queue<int> rqueue = pqueue.priorRecvs;
-		recvs = (it->second).priorRecvs;
-		int dlks = (it->second).noDlks;
-		int preRm = (it->second).preRemove;
+		// update the pending receives of src in place
+		RecvQueue& recvs = proc.priorRecvs;
+		int preRm = proc.preRemove;
 		// int max = (recvlclk > rqueue.back()) ? recvlclk + 1 : rqueue.back() + 1;
 		// printf("[back = %i] ", recvs.back());
-		printf(" preRm : %i ",preRm);
+		logDebug(" preRm : %i ",preRm);
 		if (recvs.empty()) {
 
 			/*printf(" empty ");*/
 			
 			/* In this step, pushing in queue at least one element */
 			int t = (preRm > recvlclk) ? preRm : recvlclk;
-			for (i = t - increment; i < rootRecvs.size(); i++) {
-				if (rootRecvs[i] == -1 || rootRecvs[i] == src)
+			for (c = t + 1; c < rootRecvs.end(); c++) {
+				if (rootRecvs.at(c) == -1 || rootRecvs.at(c) == src)
 				// add receiving queue of src process into map
-					recvs.push(i+1+increment);
+					recvs.push(c);
 			}
 			/* So there is no case of popping being taken on empty queue */
 			/*printf("[front = %i back = %i] ", recvs.front(), recvs.back());*/
-			it->second.preRemove = recvs.front();
+			setPreRemove(src, recvs.front());
 			recvs.pop();
 			/*printf("[front = %i back = %i] ", recvs.front(), recvs.back());*/
-			if (recvs.empty()) printf(" Empty!!! ");
+			if (recvs.empty()) logDebug(" Empty!!! ");
 		} else {
-			printf("not empty");
+			logDebug("not empty");
 			/* Queue is not empty so it is OK to get back at this step */
 			int back = recvs.back(); 
 			/*printf(" %i ", back);*/
@@ -152,30 +160,24 @@ void Controller::manipulateCommProcs(int src, int recvlclk, int lclk, FILE* file
 			if (recvlclk > back) {
 				/*printf(" case1 ");*/
 				while(!recvs.empty()) {
-					if (rootRecvs[recvs.front()-1-increment] == src) {
-						fprintf(file, "Deadlock happens at RC = %i , RECV( %i )\n", recvs.front(), src);
-						printf(" Deadlock ");
-						dlks++;
-					}
+					if (rootRecvs.at(recvs.front()) == src)
+						deadlock(proc, recvs.front(), src, file);
 					recvs.pop();
 				}
-				for (i = back; i < recvlclk; i++) {
-					if (rootRecvs[i-increment] == src) {
-						fprintf(file, "Deadlock happens at RC = %i , RECV( %i )\n", i + 1, src);
-						printf(" Deadlock ");
-						dlks++;
-					}
+				for (c = back + 1; c <= recvlclk; c++) {
+					if (rootRecvs.at(c) == src)
+						deadlock(proc, c, src, file);
 				} 
-				for (i = recvlclk - increment; i < rootRecvs.size(); i++) {
-					if (rootRecvs[i] == -1 || rootRecvs[i] == src)
+				for (c = recvlclk + 1; c < rootRecvs.end(); c++) {
+					if (rootRecvs.at(c) == -1 || rootRecvs.at(c) == src)
 					/* add receiving queue of src process into map */
-						recvs.push(i+1+increment);
+						recvs.push(c);
 				}
 				/*printf("[front = %i back = %i] ", recvs.front(), recvs.back());*/
-				it->second.preRemove = recvs.front();
+				setPreRemove(src, recvs.front());
 				recvs.pop();
 				/*printf("[front = %i back = %i] ", recvs.front(), recvs.back());*/
-				if (recvs.empty()) printf(" Empty!!! ");
+				if (recvs.empty()) logDebug(" Empty!!! ");
 			}
 			/* CASE iterator of recvs remaining in queue is greater than receving local clock */ 
 			else {
@@ -183,91 +185,67 @@ void Controller::manipulateCommProcs(int src, int recvlclk, int lclk, FILE* file
 				int tmp;
 				while (!recvs.empty() && (tmp = recvs.front()) <= recvlclk) {
 					/*printf("[front = %i back = %i] ", tmp, recvs.back());*/
-					if (rootRecvs[tmp - 1 - increment] == src) {
-						fprintf(file, "Deadlock happens at RC = %i , RECV( %i )\n", tmp, src);
-						printf(" Deadlock ");
-						dlks++;
-					}
+					if (rootRecvs.at(tmp) == src)
+						deadlock(proc, tmp, src, file);
 					recvs.pop();
 				}
 				/*printf(" EndRemove ");*/
 				/*printf("[front = %i back = %i] ", recvs.front(), recvs.back());*/
-				for (i = back - increment; i < rootRecvs.size(); i++) {
-					if (rootRecvs[i] == -1 || rootRecvs[i] == src) {
+				for (c = back + 1; c < rootRecvs.end(); c++) {
+					if (rootRecvs.at(c) == -1 || rootRecvs.at(c) == src) {
 					/*add receiving queue of src process into map*/
-						// printf("Enter %i", i);
-						recvs.push(i+1+increment);
+						// printf("Enter %i", c);
+						recvs.push(c);
 						/*printf("[front = %i back = %i] ", recvs.front(), recvs.back());*/
 					}
 				}
 				/*printf("[front = %i back = %i] ", recvs.front(), recvs.back());*/
-				it->second.preRemove = recvs.front();
+				setPreRemove(src, recvs.front());
 				recvs.pop();
 				/*printf("[front = %i back = %i] ", recvs.front(), recvs.back());*/
-				if (recvs.empty()) printf(" Empty!!! ");
+				if (recvs.empty()) logDebug(" Empty!!! ");
 			}
 		}
-		it->second.priorRecvs = recvs;
-		it->second.noDlks = dlks;
 	}
 }
 
+/* At MPI_Finalize : receives still queued for rank can never be matched by it.
+   Returns the deadlocks found for rank, -1 if it never sent to the root. */
+int Controller::drainQueue(int rank, FILE* file) {
+	if (!commProcs[rank].initialized)
+		return -1;
+	// at MPI_Finalize queue is empty which also mean that all possible recvs is added or just remain non-added recvs (*)
+	// so definitely not happen deadlock in this queue causing by recvs standing outside queue
+	RecvQueue& recvs = commProcs[rank].priorRecvs;
+	while (!recvs.empty()) {
+		int tmp = recvs.front();
+		if (rootRecvs.at(tmp) == rank)
+			deadlock(commProcs[rank], tmp, rank, file);
+		recvs.pop();
+	}
+	return commProcs[rank].noDlks;
+}
+
 void Controller::checkRemainQueue(int rank, FILE* file) {
-	map<int, Process >::iterator it = commProcs.find(rank);
-	// map<int, RecvQueue >::iterator it = commProcs.find(rank);
-	if (it == commProcs.end()) {
+	int dlks = drainQueue(rank, file);
+	if (dlks < 0) {
 		printf("\nProcess %d check queue: not initalized \n", rank);
 		return;
+	}
+	printf("\nProcess %d check queue: initalized \n", rank);
+	if (dlks > 0) {
+		printf("\tDealock happens. No of deadlocks happening : %i\n", dlks);
 	} else {
-		// at MPI_Finalize queue is empty which also mean that all possible recvs is added or just remain non-added recvs (*)
-		// so definitely not happen deadlock in this queue causing by recvs standing outside queue
-		printf("\nProcess %d check queue: initalized \n", rank);
-		RecvQueue recvs = it->second.priorRecvs;
-		int dlks = (it->second).noDlks;
-		/*fprintf(file, "noDlks = %i", dlks);*/
-		// printf("[front = %i back = %i] ", recvs.front(), recvs.back());
-		if (!recvs.empty()) {
-			int tmp;
-			while (!recvs.empty()) {
-				tmp = recvs.front();
-				if (rootRecvs[tmp - 1 - increment] == rank) {
-					fprintf(file, "Deadlock happens at RC = %i , RECV( %i )\n", tmp, rank);
-					dlks++;
-					// return;
-				}
-				recvs.pop();
-			}
-		} /*else {
-			// at MPI_Finalize queue is empty which also mean that all possible recvs is added or just remain non-added recvs (*)
-			// so definitely not happen deadlock in this queue causing by recvs standing outside queue
-		}
-		int i;
-		int back = recvs.back();
-		printf("\nBack of queue : %d", back);
-		for (i = back; i < rootRecvs.size(); i++) {
-			if (rootRecvs[i] == rank) {
-				printf(" Deadlock!!! ");
-				return 1;
-			}
-		}*/
-		if (dlks > 0) {
-			printf("\tDealock happens. No of deadlocks happening : %i\n", dlks);
-		} else {
-			printf("\tNo dealock !!!\n");
-		}
-		return ;
+		printf("\tNo dealock !!!\n");
 	}
 }
 
 void Controller::removeRootRecvs(int toIter) {
-	if (toIter > increment) {
-		rootRecvs.erase(rootRecvs.begin(), rootRecvs.begin() + toIter - increment);
-		increment = toIter;
-	}
+	rootRecvs.dropTo(toIter);
 }
 
-void initController(Controller **controller) {
-	(*controller) = new Controller();
+void initController(Controller **controller, int nProc, int rootProc) {
+	(*controller) = new Controller(nProc, rootProc);
 }
 
 void addRootRecv(Controller* controller, int lclk, int from) {
@@ -286,6 +264,14 @@ void printProcRecvs(Controller* controller, int src) {
 	controller->printProcRecvs(src);
 }
 
+int drainQueue(Controller* controller, int rank, FILE* file) {
+	return controller->drainQueue(rank, file);
+}
+
+int deadlocksFound(Controller* controller) {
+	return controller->deadlocks();
+}
+
 void checkRemainQueue(Controller* controller, int rank, FILE* file) {
 	controller->checkRemainQueue(rank,file);
 	/*if (controller->checkRemainQueue(rank) == 1) {
@@ -295,8 +281,8 @@ void checkRemainQueue(Controller* controller, int rank, FILE* file) {
 	}*/
 }
 
-int minPreRemove(Controller* controller, int nProc, int rootProc) {
-	return controller->minPreRemove(nProc,rootProc);
+int minPreRemove(Controller* controller) {
+	return controller->minPreRemove();
 }
 
 void removeRootRecvs(Controller* controller, int toIter) {
@@ -0,0 +1,44 @@
+#include "Log.h"
+
+#include <string.h>
+#include <unistd.h>
+
+int logLevel = LOG_INFO;
+
+/* each thread formats into its own buffer, no lock on the logging path */
+static __thread char* logBuf = NULL;
+static __thread int logLen = 0;
+
+void logFlush() {
+	int off = 0;
+	if (logBuf == NULL || logLen == 0) return;
+	/* keep the order with what already went through stdio */
+	fflush(stdout);
+	while (off < logLen) {
+		int n = write(STDOUT_FILENO, logBuf + off, logLen - off);
+		if (n <= 0) break;
+		off += n;
+	}
+	logLen = 0;
+}
+
+void logWrite(const char* format, ...) {
+	va_list args;
+	int n;
+	if (logBuf == NULL) {
+		logBuf = (char*) malloc(LOG_BUFFER);
+		memAlloc(LOG_BUFFER);
+	}
+	va_start(args, format);
+	n = vsnprintf(logBuf + logLen, LOG_BUFFER - logLen, format, args);
+	va_end(args);
+	if (n >= LOG_BUFFER - logLen) {
+		/* did not fit : flush and format again */
+		logFlush();
+		va_start(args, format);
+		n = vsnprintf(logBuf, LOG_BUFFER, format, args);
+		va_end(args);
+		if (n >= LOG_BUFFER) n = LOG_BUFFER - 1;
+	}
+	if (n > 0) logLen += n;
+}
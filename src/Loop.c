@@ -1,55 +1,130 @@
 #include "Loop.h"
 
 Loop::Loop():
-head(NULL),
-tail(NULL)
-{}
-
-Loop::~Loop() {}
-
-void Loop::addIter(Iter* iter, int rank) {
-	if (!iter) return;
-	if (head == NULL) {
-		printf("Rank %d : Add First Iter\n", rank);
-		head = tail = iter;
-		//cout<< "Rank " << rank << ": ";
-		//print();
-	} else {
-		printf("Rank %d : Add Not first Iter\n", rank);
-		tail->next = iter;
-		iter->prev = tail;
-		tail = iter;
+first(NULL),
+last(NULL),
+patterns(0),
+patternCap(0),
+poolIter(NULL),
+poolNext(NULL),
+poolSize(0),
+poolCap(0),
+slots(NULL),
+bits(0)
+{
+	for (int f = 0; f < LOOP_FIELDS; f++)
+		fields[f] = NULL;
+}
+
+Loop::~Loop() {
+	release();
+}
+
+/* gives the whole arena back, the loop can be filled again afterwards */
+void Loop::release() {
+	for (int f = 0; f < LOOP_FIELDS; f++) {
+		free(fields[f]);
+		fields[f] = NULL;
 	}
+	free(first);
+	free(last);
+	free(poolIter);
+	free(poolNext);
+	free(slots);
+	memFree((long long) patternCap * (LOOP_FIELDS + 2) * sizeof(int) +
+		(long long) poolCap * 2 * sizeof(int) + (bits ? (1u << bits) * sizeof(int) : 0));
+	first = last = poolIter = poolNext = slots = NULL;
+	patterns = patternCap = poolSize = poolCap = 0;
+	bits = 0;
+}
+
+unsigned Loop::home(Values* values) {
+	return (unsigned) ((values->hash() * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+bool Loop::matchAt(int p, Values* values) {
+	return fields[0][p] == values->getNumSend() && fields[1][p] == values->getNumRecv() &&
+		fields[2][p] == values->getSumSrc() && fields[3][p] == values->getSumDest() &&
+		fields[4][p] == values->getXorSrc() && fields[5][p] == values->getXorDest();
 }
 
-void Loop::appendIter(Iter* iter, int rank) {
-	printf("Rank %d : Enter append Iter\n", rank);
-	
-	Iter* it = head;
-	Values* values = iter->getValues();
-	int match_flag = 0;
-	
-	while(it) {
-		printf("Rank %d : Enter while\n", rank);
-		//cout<< "Rank " << rank << ": " << it->toString();
-		if(it->getValues()->match(values)) {
-
-			match_flag = 1;
-			break;
+void Loop::grow() {
+	int* old = slots;
+	unsigned oldSize = bits ? 1u << bits : 0;
+	bits = bits ? bits + 1 : LOOP_MIN_BITS;
+	slots = (int*) calloc(1u << bits, sizeof(int));
+	memAlloc(((1u << bits) - oldSize) * sizeof(int));
+	unsigned mask = (1u << bits) - 1;
+	for (unsigned i = 0; i < oldSize; i++) {
+		if (old[i] != 0) {
+			int p = old[i] - 1;
+			Values values(fields[0][p], fields[1][p], fields[2][p], fields[3][p], fields[4][p], fields[5][p]);
+			unsigned j = home(&values);
+			while (slots[j] != 0) j = (j + 1) & mask;
+			slots[j] = old[i];
 		}
-		
-		it = it->next;
 	}
-	printf("Rank %d : Out while\n", rank);
-
-	if(match_flag) {
-		printf("Rank %d : Enter match\n", rank);
-		it->addIterCount(iter->getIterAt(0));
-	
-	} else {
-		printf("Rank %d : Enter not match\n", rank);
-		addIter(iter, rank);
+	free(old);
+}
+
+void Loop::addPattern(Values* values) {
+	if (patterns == patternCap) {
+		int cap = patternCap ? 2 * patternCap : 16;
+		for (int f = 0; f < LOOP_FIELDS; f++)
+			fields[f] = (int*) realloc(fields[f], cap * sizeof(int));
+		first = (int*) realloc(first, cap * sizeof(int));
+		last = (int*) realloc(last, cap * sizeof(int));
+		memAlloc((long long) (cap - patternCap) * (LOOP_FIELDS + 2) * sizeof(int));
+		patternCap = cap;
 	}
+	fields[0][patterns] = values->getNumSend();
+	fields[1][patterns] = values->getNumRecv();
+	fields[2][patterns] = values->getSumSrc();
+	fields[3][patterns] = values->getSumDest();
+	fields[4][patterns] = values->getXorSrc();
+	fields[5][patterns] = values->getXorDest();
+	first[patterns] = last[patterns] = -1;
+	patterns++;
+}
+
+void Loop::addIterCount(int p, int iter) {
+	if (poolSize == poolCap) {
+		int cap = poolCap ? 2 * poolCap : 64;
+		poolIter = (int*) realloc(poolIter, cap * sizeof(int));
+		poolNext = (int*) realloc(poolNext, cap * sizeof(int));
+		memAlloc((long long) (cap - poolCap) * 2 * sizeof(int));
+		poolCap = cap;
+	}
+	poolIter[poolSize] = iter;
+	poolNext[poolSize] = -1;
+	if (last[p] < 0)
+		first[p] = poolSize;
+	else
+		poolNext[last[p]] = poolSize;
+	last[p] = poolSize++;
+}
+
+void Loop::appendIter(int iter, Values* values, int rank) {
+	logTrace("Rank %d : Enter append Iter\n", rank);
+
+	if (2 * (patterns + 1) > (bits ? (1 << bits) : 0)) grow();
+	unsigned mask = (1u << bits) - 1;
+	unsigned i = home(values);
+
+	/* probe the signature table instead of walking every pattern */
+	while (slots[i] != 0) {
+		if (matchAt(slots[i] - 1, values)) {
+			logTrace("Rank %d : Enter match\n", rank);
+			addIterCount(slots[i] - 1, iter);
+			return;
+		}
+		i = (i + 1) & mask;
+	}
+
+	logTrace("Rank %d : Enter not match\n", rank);
+	addPattern(values);
+	slots[i] = patterns;
+	addIterCount(patterns - 1, iter);
 }
 
 void Loop::printLoop(const char* filename, int iter, double time, int rank) {
@@ -60,10 +135,14 @@ void Loop::printLoop(const char* filename, int iter, double time, int rank) {
 		return;
 	}
 	tracefile << "[" << iter << "]" << "\n";
-	Iter* it = head;
-	while(it) {
-		tracefile << it->toString() << "\n";
-		it = it->next;
+	for (int p = 0; p < patterns; p++) {
+		tracefile << "( ";
+		for (int e = first[p]; e >= 0; e = poolNext[e])
+			tracefile << poolIter[e] << " ";
+		tracefile << ")\n";
+		for (int f = 0; f < LOOP_FIELDS; f++)
+			tracefile << fields[f][p] << "\n";
+		tracefile << "\n";
 	}
 
 	if (time != 0){ 
@@ -72,18 +151,84 @@ void Loop::printLoop(const char* filename, int iter, double time, int rank) {
 	tracefile.close();
 }
 
+/* Dense per-iteration contribution of this rank, sums and xors hold numIters rows
+   and start zeroed. Iteration indices outside [0, numIters) are ignored. */
+void Loop::signatures(int numIters, int rank, int* sums, int* xors) {
+	for (int p = 0; p < patterns; p++) {
+		for (int e = first[p]; e >= 0; e = poolNext[e]) {
+			int i = poolIter[e];
+			if (i < 0 || i >= numIters) continue;
+			int* s = &sums[i * LEAK_SUMS];
+			s[0] += fields[0][p];
+			s[1] += fields[1][p];
+			s[2] += fields[2][p];
+			s[3] += fields[3][p];
+			s[4] += fields[0][p] * rank;
+			s[5] += fields[1][p] * rank;
+			xors[i * LEAK_XORS] ^= fields[4][p];
+			xors[i * LEAK_XORS + 1] ^= fields[5][p];
+		}
+	}
+}
+
+/* Same content as printLoop in the binary trace format, see Trace.h */
+void Loop::writeLoop(const char* filename, int iter, double time, int rank) {
+	TraceBuf tb = {NULL, 0, 0};
+	size_t start = traceBeginLoop(&tb, iter, patterns, time);
+	for (int f = 0; f < LOOP_FIELDS; f++) {
+		for (int p = 0; p < patterns; p++)
+			tracePutU32(&tb, (unsigned) fields[f][p]);
+	}
+	size_t lists = tb.len;
+	for (int p = 0; p < patterns; p++) {
+		int count = 0, prev = 0;
+		for (int e = first[p]; e >= 0; e = poolNext[e])
+			count++;
+		tracePutVarint(&tb, count);
+		for (int e = first[p]; e >= 0; e = poolNext[e]) {
+			tracePutDelta(&tb, poolIter[e] - prev);
+			prev = poolIter[e];
+		}
+	}
+	traceEndLoop(&tb, start, lists);
+	if (traceAppend(&tb, filename, rank) < 0)
+		cerr << "error: unable to write trace file: " << filename;
+	traceFree(&tb);
+}
+
 void Loop::print() {
-	Iter* it = head;
-	while(it) {
-		cout << it->toString() << "\n";
-		it = it->next;
+	for (int p = 0; p < patterns; p++) {
+		cout << "( ";
+		for (int e = first[p]; e >= 0; e = poolNext[e])
+			cout << poolIter[e] << " ";
+		cout << ")\n";
+		for (int f = 0; f < LOOP_FIELDS; f++)
+			cout << fields[f][p] << "\n";
+		cout << "\n";
 	}
 }
 
-void appendIter(Loop* loop, Iter* iter, int rank) {
-	loop->appendIter(iter, rank);
+void createLoop(Loop** loop) {
+	(*loop) = new Loop();
+}
+
+void appendIter(Loop* loop, int iter, int nSend, int nRecv, int sSrc, int sDest, int xSrc, int xDest, int rank) {
+	Values values(nSend, nRecv, sSrc, sDest, xSrc, xDest);
+	loop->appendIter(iter, &values, rank);
 }
 
 void printLoop(Loop* loop, const char* filename, int iter, double time, int rank) {
 	loop->printLoop(filename, iter, time, rank);
 }
+
+void writeLoop(Loop* loop, const char* filename, int iter, double time, int rank) {
+	loop->writeLoop(filename, iter, time, rank);
+}
+
+void releaseLoop(Loop* loop) {
+	loop->release();
+}
+
+void loopSignatures(Loop* loop, int numIters, int rank, int* sums, int* xors) {
+	loop->signatures(numIters, rank, sums, xors);
+}
@@ -1,5 +1,8 @@
 #include "Memory.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 /*struct sysinfo memInfo;
 
 sysinfo (&memInfo);
@@ -8,27 +11,73 @@ long long totalVirtualMem = memInfo.totalram;
 totalVirtualMem += memInfo.totalswap;
 totalVirtualMem *= memInfo.mem_unit;*/
 
-int parseLine(char* line){
-	int i = strlen(line);
-	while (*line < '0' || *line > '9') line++;
-	line[i-3] = '\0';
-	i = atoi(line);
-	return i;
+static long long toolBytes = 0;
+static long long toolPeak = 0;
+
+static int statmFd = -1;
+static long pageKB = 0;
+
+static int sampleEvery = MEM_SAMPLE;
+static int sampleCount = 0;
+static int rssPeak = 0;
+static int appPeak = 0;
+
+/* the analysis thread and the receive path both allocate : keep the counters atomic */
+void memAlloc(long long bytes) {
+	long long now = __atomic_add_fetch(&toolBytes, bytes, __ATOMIC_RELAXED);
+	long long peak = __atomic_load_n(&toolPeak, __ATOMIC_RELAXED);
+	while (now > peak && !__atomic_compare_exchange_n(&toolPeak, &peak, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void memFree(long long bytes) {
+	__atomic_sub_fetch(&toolBytes, bytes, __ATOMIC_RELAXED);
+}
+
+long long toolMemory() {
+	return __atomic_load_n(&toolBytes, __ATOMIC_RELAXED);
+}
+
+long long peakToolMemory() {
+	return __atomic_load_n(&toolPeak, __ATOMIC_RELAXED);
 }
 
 int getMemory(){ //Note: this value is in KB!
-	FILE* file = fopen("/proc/self/status", "r");
-	int result = -1;
 	char line[128];
-
-	while (fgets(line, 128, file) != NULL){
-		if (strncmp(line, "VmRSS:", 6) == 0){
-			result = parseLine(line);
-			break;
-		}
+	long size, resident;
+	/* statm stays open : one pread per sample instead of open/parse/close of status */
+	if (statmFd < 0) {
+		statmFd = open("/proc/self/statm", O_RDONLY);
+		pageKB = sysconf(_SC_PAGESIZE) / 1024;
+		if (statmFd < 0) return -1;
 	}
-	fclose(file);
-	return result;
+	int n = pread(statmFd, line, sizeof(line) - 1, 0);
+	if (n <= 0) return -1;
+	line[n] = '\0';
+	if (sscanf(line, "%ld %ld", &size, &resident) != 2) return -1;
+	return (int) (resident * pageKB);
+}
+
+void setMemorySampling(int events) {
+	sampleEvery = (events > 0) ? events : 1;
+}
+
+/* called once per event : reads RSS every sampleEvery calls, returns it in KB or -1 */
+int sampleMemory() {
+	if (++sampleCount < sampleEvery) return -1;
+	sampleCount = 0;
+	int rss = getMemory();
+	int app = rss - (int) (toolMemory() >> 10);
+	rssPeak = (rss > rssPeak) ? rss : rssPeak;
+	appPeak = (app > appPeak) ? app : appPeak;
+	return rss;
+}
+
+int peakMemory() {
+	return rssPeak;
+}
+
+int peakAppMemory() {
+	return appPeak;
 }
 
 void printMemory() {
@@ -38,4 +87,4 @@ void printMemory() {
 /*int main(int argc, char* argv[]) {
 	printf("%i KB \n", getValue());
 	return 0;
-}*/
\ No newline at end of file
+}*/
@@ -0,0 +1,20 @@
+#include "MinTree.h"
+
+MinTree::MinTree(int n) {
+	leaves = 1;
+	while (leaves < n) leaves <<= 1;
+	/* padding leaves never win */
+	tree.assign(2 * leaves, INT_MAX);
+}
+
+MinTree::~MinTree() {}
+
+void MinTree::update(int i, int value) {
+	int node = leaves + i;
+	tree[node] = value;
+	for (node >>= 1; node >= 1; node >>= 1) {
+		int m = (tree[2 * node] < tree[2 * node + 1]) ? tree[2 * node] : tree[2 * node + 1];
+		if (tree[node] == m) break;
+		tree[node] = m;
+	}
+}
@@ -1,40 +1,91 @@
 #include "Misc.h"
 
-/* Global Variable */
-/*extern int numSend;	//The number of Send Event on each process
-extern int numRecv;	//the number of Recv Event on each process
-extern int Drank;		//The rank of the current process
-extern int sumSrc;		//The xor(src) of all Recv Event on each process
-extern int xorSrc;		//The xor(src) of all Recv Event on all processes
-extern int sumDest;	//The xor(dest) of all Send Event on each process
-extern int xorDest;		//The xor(dest) of all Send Event on all processes 
-Loop *loop;
-Iter* iter;*/
-
 extern int enabled;
 
+__thread IterCounters iterCnt;
+
+int leakOnline = 0;
+
+int traceText = 0;
+
+static Loop* loop = NULL;
+
+/* Running totals of the online check, carried across loops like summary.c does */
+static int leakSums[LEAK_SUMS];
+static int leakXors[LEAK_XORS];
+static int loopIndex = 0;
+
+/* Reduce every rank's per-iteration signature onto rank 0 and give the verdict
+   summary.c would give from the traces */
+static void verifyLoop(int numIters) {
+	int me, i;
+	PMPI_Comm_rank(MPI_COMM_WORLD, &me);
+	loopIndex++;
+	if (numIters <= 0) return;
+	int *sums = (int*) calloc((size_t) numIters * (LEAK_SUMS + LEAK_XORS), sizeof(int));
+	int *xors = sums + (size_t) numIters * LEAK_SUMS;
+	loopSignatures(loop, numIters, me, sums, xors);
+	PMPI_Reduce((me == 0) ? MPI_IN_PLACE : sums, sums, numIters * LEAK_SUMS, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+	PMPI_Reduce((me == 0) ? MPI_IN_PLACE : xors, xors, numIters * LEAK_XORS, MPI_INT, MPI_BXOR, 0, MPI_COMM_WORLD);
+	if (me == 0) {
+		int leaks = 0;
+		printf("Loop index = %d ; numIters = %d\n", loopIndex, numIters);
+		for (i = 0; i < numIters; i++) {
+			for (int k = 0; k < LEAK_SUMS; k++)
+				leakSums[k] += sums[i * LEAK_SUMS + k];
+			leakXors[0] ^= xors[i * LEAK_XORS];
+			leakXors[1] ^= xors[i * LEAK_XORS + 1];
+			// same rules as summary.c : counts, then rank sums, then pair xors
+			if (leakSums[0] != leakSums[1] || leakSums[2] != leakSums[4] ||
+				leakSums[3] != leakSums[5] || leakXors[0] != leakXors[1]) {
+				printf("Iters[%d] : Message Leaks !!!\n", i);
+				leaks++;
+			} else {
+				printf("Iters[%d] : No Message leaks !!! \n", i);
+			}
+		}
+		printf("Leaking iterations : %d / %d\n\n", leaks, numIters);
+	}
+	free(sums);
+}
+
 void beginFor() {
-	// loop = new Loop();
+	if (loop == NULL)
+		createLoop(&loop);
+	iterCnt.active = 1;
 }
+
 void beginIter() {
-	/*numSend = 0;
-	numRecv = 0;
-	sumSrc = 0;
-	sumDest = 0;
-	xorSrc = 0;
-	xorDest = 0;*/
+	iterCnt.numSend = 0;
+	iterCnt.numRecv = 0;
+	iterCnt.sumSrc = 0;
+	iterCnt.sumDest = 0;
+	iterCnt.xorSrc = 0;
+	iterCnt.xorDest = 0;
 }
 
 void endIter(int i, int rank) {
-	// createIter(&iter, i, numSend, numRecv, sumSrc, sumDest, xorSrc, xorDest);
-	// appendIter(loop, iter, rank);
-	/*printf("Rank %d : Iter %d : numSend = %d  numRecv = %d sumSrc = %d sumDest = %d xorSrc = %d xorDest = %d\n",rank , i, numSend, numRecv, sumSrc, sumDest, xorSrc, xorDest);*/
+	if (loop == NULL) return;
+	appendIter(loop, i, iterCnt.numSend, iterCnt.numRecv, iterCnt.sumSrc, iterCnt.sumDest, iterCnt.xorSrc, iterCnt.xorDest, rank);
+	logTrace("Rank %d : Iter %d : numSend = %d  numRecv = %d sumSrc = %d sumDest = %d xorSrc = %d xorDest = %d\n",
+			rank, i, iterCnt.numSend, iterCnt.numRecv, iterCnt.sumSrc, iterCnt.sumDest, iterCnt.xorSrc, iterCnt.xorDest);
 }
 
 void endFor(int iter, double time, int rank) {
-	/*stringstream temp;
-        temp << "traces/" << Drank;
-	printLoop(loop, temp.str().c_str(), iter ,time, rank);*/
+	if (loop == NULL) return;
+	if (leakOnline) {
+		verifyLoop(iter);
+	} else {
+		char filename[32];
+		snprintf(filename, sizeof(filename), "traces/%d", rank);
+		if (traceText)
+			printLoop(loop, filename, iter, time, rank);
+		else
+			writeLoop(loop, filename, iter, time, rank);
+	}
+	// the next loop starts from an empty arena
+	releaseLoop(loop);
+	iterCnt.active = 0;
 
 	/*if (Drank == 0) {
 	ofstream iterfile;
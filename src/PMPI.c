@@ -1,151 +1,1126 @@
 #include "PMPI.h"
 
 
-/* MPI_Init Profiling Interface */
-int MPI_Init(int *argc, char ***argv) {
-	/*printf("Enter init");*/
-	int result;
-	result = PMPI_Init(argc, argv);
+/* Build a datatype that addresses the piggybacked clock and the user buffer by
+   absolute address, so the message goes from/to MPI_BOTTOM without touching the
+   payload. The stamp comes first: a receive posted with a larger count than the
+   message still sees the sender's type signature as a prefix of its own. */
+static MPI_Datatype clockType(const void *buf, int count, MPI_Datatype datatype, long long *stamp) {
+	int blocklens[2] = {stampLen, count};
+	MPI_Aint displs[2];
+	MPI_Datatype types[2] = {MPI_LONG_LONG_INT, datatype};
+	MPI_Datatype ptype;
+	PMPI_Get_address(stamp, &displs[0]);
+	PMPI_Get_address((void*) buf, &displs[1]);
+	PMPI_Type_create_struct(2, blocklens, displs, types, &ptype);
+	PMPI_Type_commit(&ptype);
+	return ptype;
+}
+
+/* Exact number of bytes MPI_Pack needs for the payload plus the clock.
+   Handle sizes have nothing to do with type extents, so ask MPI and keep the
+   answer : the same few (datatype, count) pairs come back on every iteration. */
+static int packSize(int count, MPI_Datatype datatype, MPI_Comm comm) {
+	PackSize *entry = &packCache[((unsigned long) datatype * 31 + count) % PACK_CACHE];
+	unsigned gen = __atomic_load_n(&typeGen, __ATOMIC_ACQUIRE);
+	if (entry->gen != gen || entry->datatype != datatype || entry->count != count) {
+		int payload, clk;
+		PMPI_Pack_size(count, datatype, comm, &payload);
+		PMPI_Pack_size(stampLen, MPI_LONG_LONG_INT, comm, &clk);
+		entry->datatype = datatype;
+		entry->count = count;
+		entry->size = payload + clk;
+		entry->gen = gen;
+	}
+	return entry->size;
+}
+
+/* Cached facts about comm. The translation table of a communicator is built
+   once, HPL-style codes keep talking on the same few. */
+static CommRanks* commEntry(MPI_Comm comm) {
+	CommRanks *entry = &commCache[((unsigned long long) (unsigned long) comm * 0x9E3779B97F4A7C15ULL) >> 60];
+	unsigned gen = __atomic_load_n(&commGen, __ATOMIC_ACQUIRE);
+	if (entry->gen != gen || entry->comm != comm) {
+		MPI_Group group, world;
+		int inter;
+		PMPI_Comm_test_inter(comm, &inter);
+		entry->inter = inter;
+		if (inter) {
+			PMPI_Comm_remote_size(comm, &entry->size);
+			PMPI_Comm_remote_group(comm, &group);
+		} else {
+			PMPI_Comm_size(comm, &entry->size);
+			PMPI_Comm_group(comm, &group);
+		}
+		PMPI_Comm_group(MPI_COMM_WORLD, &world);
+		int *local = (int*) malloc(entry->size * sizeof(int));
+		for (int i = 0; i < entry->size; i++)
+			local[i] = i;
+		entry->ranks = (int*) realloc(entry->ranks, entry->size * sizeof(int));
+		PMPI_Group_translate_ranks(group, entry->size, local, world, entry->ranks);
+		PMPI_Group_free(&group);
+		PMPI_Group_free(&world);
+		free(local);
+		entry->comm = comm;
+		entry->gen = gen;
+	}
+	return entry;
+}
+
+/* MPI_COMM_WORLD rank of a peer given in comm */
+static int worldRank(MPI_Comm comm, int rank) {
+	if (comm == MPI_COMM_WORLD) return rank;
+	return commEntry(comm)->ranks[rank];
+}
+
+static int interComm(MPI_Comm comm) {
+	if (comm == MPI_COMM_WORLD) return 0;
+	return commEntry(comm)->inter;
+}
+
+/* Leak signature of the current iteration : a send and its matching receive
+   add the same (rank + peer) term on both sides. Traffic outside a loop costs nothing. */
+static inline void countSend(MPI_Comm comm, int dest) {
+	if (!iterCnt.active || dest == MPI_PROC_NULL) return;
+	int peer = worldRank(comm, dest);
+	iterCnt.numSend++;
+	iterCnt.sumDest += peer;
+	iterCnt.xorDest ^= myrank + peer;
+}
+
+static inline void countRecv(MPI_Comm comm, int source) {
+	if (!iterCnt.active || source == MPI_PROC_NULL) return;
+	int peer = worldRank(comm, source);
+	iterCnt.numRecv++;
+	iterCnt.sumSrc += peer;
+	iterCnt.xorSrc ^= peer + myrank;
+}
+
+/* Lock-free max, other threads may merge or increment at the same time */
+static inline void atomicMax(long long *var, long long v) {
+	long long cur = __atomic_load_n(var, __ATOMIC_RELAXED);
+	while (v > cur && !__atomic_compare_exchange_n(var, &cur, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* What a message sent now carries */
+static inline void takeStamp(long long *stamp) {
+	for (int c = 0; c < numRoots; c++)
+		stamp[c] = __atomic_load_n(&vclk[c], __ATOMIC_RELAXED);
+	stamp[numRoots] = __atomic_load_n(&knownEpoch, __ATOMIC_RELAXED);
+}
+
+/* Staging pool of the calling thread, made on its first use */
+static Pool* localPool() {
+	if (threadPool == NULL) {
+		initPool(&threadPool, poolLimit);
+		int i = __atomic_fetch_add(&numPools, 1, __ATOMIC_ACQ_REL);
+		if (i < MAX_THREADS)
+			__atomic_store_n(&pools[i], threadPool, __ATOMIC_RELEASE);
+	}
+	return threadPool;
+}
+
+/* Tool state, once MPI is up whichever way it was initialized */
+static void initTool() {
 	cTime = MPI_Wtime();
 	PMPI_Comm_rank(MPI_COMM_WORLD, &myrank);
 	/*printf("\nRank : %d", myrank);*/
-	PMPI_Comm_size(MPI_COMM_WORLD, &size);
+	PMPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+	/* every rank must agree on the wire format, so take it from the environment */
+	char *mode = getenv("DEADRACE_PIGGYBACK");
+	if (mode != NULL && strcmp(mode, "pack") == 0)
+		pbMode = PB_PACK;
+	char *limit = getenv("DEADRACE_POOL_LIMIT");
+	poolLimit = (long long) ((limit != NULL) ? atoi(limit) : POOL_LIMIT) << 20;
+	localPool();
+	initRequests(&reqTable);
+	if (threaded)
+		shareRequests(reqTable);
+	char *verbose = getenv("DEADRACE_VERBOSE");
+	if (verbose != NULL)
+		logLevel = atoi(verbose);
+	char *asyncMode = getenv("DEADRACE_ASYNC");
+	asyncAnalysis = (asyncMode != NULL && atoi(asyncMode) != 0);
+	// receives of several threads are ordered by the helper, never inline
+	if (threaded)
+		asyncAnalysis = 1;
+	char *leak = getenv("DEADRACE_LEAK");
+	leakOnline = (leak != NULL && strcmp(leak, "online") == 0);
+	char *format = getenv("DEADRACE_TRACE");
+	traceText = (format != NULL && strcmp(format, "text") == 0);
+	char *sample = getenv("DEADRACE_MEM_SAMPLE");
+	if (sample != NULL)
+		setMemorySampling(atoi(sample));
+	char *stride = getenv("DEADRACE_ROOT_STRIDE");
+	rootStride = (stride != NULL && atoi(stride) > 0) ? atoi(stride) : nprocs;
+	// every message carries a clock per root, keep the stamp bounded
+	if ((nprocs + rootStride - 1) / rootStride > MAX_ROOTS) {
+		if (myrank == rootrecv)
+			fprintf(stderr, "DEADRACE_ROOT_STRIDE=%d gives more than %d roots, the stride is widened to %d\n",
+					rootStride, MAX_ROOTS, (nprocs + MAX_ROOTS - 1) / MAX_ROOTS);
+		rootStride = (nprocs + MAX_ROOTS - 1) / MAX_ROOTS;
+	}
+	numRoots = (nprocs + rootStride - 1) / rootStride;
+	myRoot = (myrank % rootStride == 0) ? myrank / rootStride : -1;
+	stampLen = numRoots + 1;
+	if (numRoots > 1 && rootStride > 1 && myrank == rootrecv)
+		fprintf(stderr, "%d roots : only the receives of the ranks multiple of %d are analyzed, "
+				"each message carries %d stamp bytes\n", numRoots, rootStride, (int) (stampLen * sizeof(long long)));
+	char *checkpoint = getenv("DEADRACE_CHECKPOINT");
+	if (checkpoint != NULL)
+		checkpointEvery = atoi(checkpoint);
 	if (enabled) {
-		lclk = 0;
+		memset(vclk, 0, sizeof(vclk));
 		/*enabled = 0;*/
-		if (myrank == rootrecv) {
+		if (myRoot >= 0) {
 			/*printf("\n Init Enter");*/
-			fresult = fopen("result","w");
-			initController(&controller);
+			if (myrank == rootrecv) {
+				fresult = fopen("result","w");
+			} else {
+				char name[32];
+				snprintf(name, sizeof(name), "result.%d", myrank);
+				fresult = fopen(name, "w");
+			}
+			initController(&controller, nprocs, myrank);
+			initAnalyzer(&analyzer, controller, myrank, fresult);
+			if (asyncAnalysis)
+				startAnalyzer(analyzer);
 		}
 	}	
+}
+
+/* MPI_Init Profiling Interface */
+int MPI_Init(int *argc, char ***argv) {
+	/*printf("Enter init");*/
+	int result;
+	result = PMPI_Init(argc, argv);
+	initTool();
 	return result;
 }
 
-/* MPI_Send Profiling Interface */
-int MPI_Send(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm) {
-	if (enabled) {
-		int num = sizeof (MPI_LONG_LONG_INT) + sizeof(datatype) * count;	
-		int packsize = 0;
-		char *packbuf = (char*) malloc (num);
-		MPI_Pack (buf, count, datatype, packbuf, num, &packsize, comm);
-		MPI_Pack (&lclk, 1, MPI_LONG_LONG_INT, packbuf, num, &packsize, comm);
+/* MPI_Init_thread Profiling Interface */
+int MPI_Init_thread(int *argc, char ***argv, int required, int *provided) {
+	int result = PMPI_Init_thread(argc, argv, required, provided);
+	threaded = (*provided == MPI_THREAD_MULTIPLE);
+	initTool();
+	return result;
+}
+
+/* Payload and stamp packed into a pool buffer, for the pack piggyback mode */
+static char* packMessage(const void *buf, int count, MPI_Datatype datatype, const long long *stamp, MPI_Comm comm, int *packsize) {
+	int num = packSize(count, datatype, comm);
+	char *packbuf = poolAcquire(localPool(), num);
+	*packsize = 0;
+	MPI_Pack (buf, count, datatype, packbuf, num, packsize, comm);
+	MPI_Pack ((void*) stamp, stampLen, MPI_LONG_LONG_INT, packbuf, num, packsize, comm);
+	return packbuf;
+}
+
+static void unpackMessage(char *packbuf, int num, void *buf, int count, MPI_Datatype datatype, long long *stamp, MPI_Comm comm) {
+	int pos = 0;
+	MPI_Unpack (packbuf, num, &pos, buf, count, datatype, comm);
+	MPI_Unpack (packbuf, num, &pos, stamp, stampLen, MPI_LONG_LONG_INT, comm);
+}
+
+/* Report the payload only, so MPI_Get_count works in the application */
+static void payloadStatus(MPI_Status *status, MPI_Datatype ptype, MPI_Datatype datatype) {
+	int elems;
+	PMPI_Get_elements(status, ptype, &elems);
+	if (elems != MPI_UNDEFINED && elems >= stampLen)
+		PMPI_Status_set_elements(status, datatype, elems - stampLen);
+}
+
+/* Same from a count in bytes : a probe sees the stamp as part of the message,
+   and pack mode receives it as MPI_PACKED */
+static void stripStamp(MPI_Status *status, MPI_Comm comm) {
+	if (status == MPI_STATUS_IGNORE || status->MPI_SOURCE == MPI_PROC_NULL) return;
+	int bytes, clk = stampLen * sizeof(long long);
+	PMPI_Get_count(status, MPI_BYTE, &bytes);
+	if (pbMode == PB_PACK)
+		PMPI_Pack_size(stampLen, MPI_LONG_LONG_INT, comm, &clk);
+	if (bytes != MPI_UNDEFINED && bytes >= clk)
+		PMPI_Status_set_elements(status, MPI_BYTE, bytes - clk);
+}
+
+typedef int (*SendFn)(const void*, int, MPI_Datatype, int, int, MPI_Comm);
+
+typedef int (*IsendFn)(const void*, int, MPI_Datatype, int, int, MPI_Comm, MPI_Request*);
+
+/* Blocking send of any mode, psend is the matching PMPI call */
+static int clockSend(SendFn psend, const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm) {
+	countSend(comm, dest);
+	if (enabled && pbMode == PB_DATATYPE) {
+		long long stamp[MAX_STAMP];
+		takeStamp(stamp);
+		MPI_Datatype ptype = clockType(buf, count, datatype, stamp);
+		int result = psend(MPI_BOTTOM, 1, ptype, dest, tag, comm);
+		PMPI_Type_free(&ptype);
+		return result;
+	} else if (enabled) {
+		long long stamp[MAX_STAMP];
+		takeStamp(stamp);
+		int packsize;
+		char *packbuf = packMessage(buf, count, datatype, stamp, comm, &packsize);
 		/*printf("\nProcess %i (send) : lclk = %i ", myrank, lclk);*/
-		return PMPI_Send(packbuf, packsize, MPI_PACKED, dest, tag, comm);
+		int result = psend(packbuf, packsize, MPI_PACKED, dest, tag, comm);
+		poolRelease(localPool(), packbuf);
+		return result;
 	} else {
-		return PMPI_Send(buf, count, datatype, dest, tag, comm);
+		return psend(buf, count, datatype, dest, tag, comm);
 	}
 }
 
-
-/*int MPI_Isend(void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm, MPI_Request *request) {
+/* Nonblocking send of any mode */
+static int clockIsend(IsendFn pisend, const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm, MPI_Request *request) {
+	countSend(comm, dest);
 	if (enabled) {
-		int num = sizeof (int) + sizeof(datatype) * count;	
-		int packsize = 0;
-		char *packbuf = (char*) malloc (num);
-		MPI_Pack (buf, count, datatype, packbuf, num, &packsize, comm);
-		MPI_Pack (&lclk, 1, MPI_INT, packbuf, num, &packsize, comm);
-		return PMPI_Isend(packbuf, packsize, MPI_PACKED, dest, tag, comm, request);
+		int result;
+		// the clock must stay readable until the send completes
+		PendingReq *pr = createRequest(reqTable);
+		pr->kind = REQ_SEND;
+		takeStamp(pr->stamp);
+		if (pbMode == PB_DATATYPE) {
+			MPI_Datatype ptype = clockType(buf, count, datatype, pr->stamp);
+			result = pisend(MPI_BOTTOM, 1, ptype, dest, tag, comm, request);
+			PMPI_Type_free(&ptype);
+		} else {
+			int packsize;
+			pr->pool = localPool();
+			pr->packbuf = packMessage(buf, count, datatype, pr->stamp, comm, &packsize);
+			result = pisend(pr->packbuf, packsize, MPI_PACKED, dest, tag, comm, request);
+		}
+		if (result != MPI_SUCCESS) {
+			if (pr->packbuf != NULL)
+				poolRelease(pr->pool, pr->packbuf);
+			recycleRequest(reqTable, pr);
+			return result;
+		}
+		int done = 0;
+		PMPI_Request_get_status(*request, &done, MPI_STATUS_IGNORE);
+		if (done) {
+			// already left the buffers, the record is not needed
+			if (pr->packbuf != NULL)
+				poolRelease(pr->pool, pr->packbuf);
+			recycleRequest(reqTable, pr);
+		} else {
+			pr->request = *request;
+			insertRequest(reqTable, pr);
+		}
+		return result;
+	} else {
+		return pisend(buf, count, datatype, dest, tag, comm, request);
+	}
+}
+
+/* MPI_Send, MPI_Ssend, MPI_Rsend, MPI_Bsend Profiling Interface */
+#define SEND_WRAPPER(name) \
+int MPI_##name(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm) { \
+	COUNT_CALL(CALL_##name); \
+	return clockSend(PMPI_##name, buf, count, datatype, dest, tag, comm); \
+}
+
+SEND_CALLS(SEND_WRAPPER)
+
+/* MPI_Isend, MPI_Issend, MPI_Irsend, MPI_Ibsend Profiling Interface */
+#define ISEND_WRAPPER(name) \
+int MPI_##name(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm, MPI_Request *request) { \
+	COUNT_CALL(CALL_##name); \
+	return clockIsend(PMPI_##name, buf, count, datatype, dest, tag, comm, request); \
+}
+
+ISEND_CALLS(ISEND_WRAPPER)
+
+#define EPOCH_AT(i)	epochChunks[(i) / EPOCH_CHUNK][(i) % EPOCH_CHUNK]
+
+/* A lazy collective : count it, the root remembers its clock if it moved since the last one.
+   MPI orders the collectives of a communicator, so only one thread appends at a time. */
+static void epochEvent() {
+	long long e = __atomic_add_fetch(&epoch, 1, __ATOMIC_RELAXED);
+	// a peer past a later collective may already have told this rank about it
+	atomicMax(&knownEpoch, e);
+	if (myRoot < 0) return;
+	long long clk = __atomic_load_n(&vclk[myRoot], __ATOMIC_RELAXED);
+	int n = numEpochClocks;
+	if (n > 0 && EPOCH_AT(n - 1).clk == clk) return;
+	// out of room : later epochs resolve to the last clock kept, an earlier one
+	if (n == EPOCH_CHUNK * EPOCH_CHUNKS) return;
+	if (n % EPOCH_CHUNK == 0) {
+		epochChunks[n / EPOCH_CHUNK] = (EpochClock*) malloc(EPOCH_CHUNK * sizeof(EpochClock));
+		memAlloc(EPOCH_CHUNK * sizeof(EpochClock));
+	}
+	EPOCH_AT(n).epoch = e;
+	EPOCH_AT(n).clk = clk;
+	__atomic_store_n(&numEpochClocks, n + 1, __ATOMIC_RELEASE);
+}
+
+/* Root clock at lazy collective e, binary search of the last change up to e */
+static long long epochClock(long long e) {
+	int lo = 0, hi = __atomic_load_n(&numEpochClocks, __ATOMIC_ACQUIRE);
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (EPOCH_AT(mid).epoch <= e)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo == 0) ? 0 : EPOCH_AT(lo - 1).clk;
+}
+
+/* Merge a stamp heard from another rank. A root's own component is already the largest */
+static inline void mergeStamp(const long long *stamp) {
+	for (int c = 0; c < numRoots; c++) {
+		if (c != myRoot)
+			atomicMax(&vclk[c], stamp[c]);
+	}
+	atomicMax(&knownEpoch, stamp[numRoots]);
+}
+
+/* Clock bookkeeping of a completed receive, blocking or not */
+static void recvEvent(int source, MPI_Status *status, const long long *stamp) {
+	if (status->MPI_SOURCE == MPI_PROC_NULL) return;
+	if (myRoot >= 0) {
+		// the sender's clock, with what it learnt through lazy collectives
+		long long recvlclk = epochClock(stamp[numRoots]);
+		if (stamp[myRoot] > recvlclk)
+			recvlclk = stamp[myRoot];
+		mergeStamp(stamp);
+		// increase local clock when receiving on root process 
+		long long clk = __atomic_add_fetch(&vclk[myRoot], 1, __ATOMIC_RELAXED);
+		int from = (source == MPI_ANY_SOURCE) ? -1 : source;
+		// hand the event to the helper thread, or analyze it right here
+		if (asyncAnalysis)
+			pushRootEvent(analyzer, clk, from, status->MPI_SOURCE, recvlclk);
+		else
+			analyzeRootEvent(analyzer, clk, from, status->MPI_SOURCE, recvlclk);
 	} else {
-		return PMPI_Isend(buf, count, datatype, dest, tag, comm, request);
+		mergeStamp(stamp);
+		/*printf("Enter");*/
+		/*printf("\nProcess %i (recv) : lclk = %i ", myrank, lclk);*/
 	}
-}*/
+}
 
 /* MPI_Recv Profiling Interface */
 int MPI_Recv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Status *status) 
 {
+	COUNT_CALL(CALL_Recv);
 	if (enabled) {
 		/*int r, rt;
 		fprintf(stdout,"\n % d : Enter", myrank);
 		rt = PMPI_Comm_rank(MPI_COMM_WORLD, &r);
 		printf("\n%d", rt);*/
 		int result;
-		int recvlclk=0;
+		long long stamp[MAX_STAMP] = {0};
+		MPI_Status st;
+		if (status == MPI_STATUS_IGNORE) status = &st;
 		
-		// unpack local clock piggypacking on receiving message
-		int pos = 0;
-		int num = sizeof (MPI_LONG_LONG_INT) + sizeof(datatype) * count;
-		char *packbuf = (char*) malloc (num);
-		PMPI_Recv (packbuf, num, MPI_PACKED, source, tag, comm, status);
-		result = MPI_Unpack (packbuf, num, &pos, buf, count, datatype, comm);
-		MPI_Unpack (packbuf, num, &pos, &recvlclk, 1, MPI_LONG_LONG_INT, comm);
+		if (pbMode == PB_DATATYPE) {
+			// receive local clock and payload in place
+			MPI_Datatype ptype = clockType(buf, count, datatype, stamp);
+			result = PMPI_Recv (MPI_BOTTOM, 1, ptype, source, tag, comm, status);
+			payloadStatus(status, ptype, datatype);
+			PMPI_Type_free(&ptype);
+		} else {
+			// unpack local clock piggypacking on receiving message
+			int num = packSize(count, datatype, comm);
+			char *packbuf = poolAcquire(localPool(), num);
+			result = PMPI_Recv (packbuf, num, MPI_PACKED, source, tag, comm, status);
+			// nothing arrived from MPI_PROC_NULL, buf must stay as it was
+			if (status->MPI_SOURCE != MPI_PROC_NULL)
+				unpackMessage(packbuf, num, buf, count, datatype, stamp, comm);
+			stripStamp(status, comm);
+			poolRelease(localPool(), packbuf);
+		}
 		
-		if (myrank == rootrecv) {
-			// increase local clock when receiving on root process 
-			//printf("Enter");
-			/*fprintf(stdout,"\nEnter");*/
-			lclk++;
-			int from = (source == MPI_ANY_SOURCE) ? -1 : source;
-			int src = status->MPI_SOURCE;
-			printf("\nProcess %i (recv) : source = %i lclk = %i recvlclk = %i src = %i ", myrank, from,  lclk, recvlclk, src);
-			int minPreRm;
-			if (lclk % 100 == 0) {
-				minPreRm = minPreRemove(controller,size,rootrecv);
-				printf(" minPreRemove = %i ", minPreRm);
-				removeRootRecvs(controller, minPreRm);
-			}
-			// add to root receiving list
-			addRootRecv(controller, lclk, from);
+		recvEvent(source, status, stamp);
+		countRecv(comm, status->MPI_SOURCE);
+		return result;
+	} else {
+		MPI_Status st;
+		if (status == MPI_STATUS_IGNORE) status = &st;
+		int result = PMPI_Recv(buf, count, datatype, source, tag, comm, status);
+		countRecv(comm, status->MPI_SOURCE);
+		return result;
+	}
+}
+
+/* Record of a nonblocking or persistent receive, and where MPI must put the
+   message : in place with the stamp, in a staging buffer, or just the payload.
+   Inside a loop the record is kept even without a clock : the source is only known then */
+static PendingReq* recvRecord(void *buf, int count, MPI_Datatype datatype, int source, MPI_Comm comm,
+		void **rbuf, int *rcount, MPI_Datatype *rtype) {
+	PendingReq *pr = createRequest(reqTable);
+	pr->kind = REQ_RECV;
+	pr->source = source;
+	pr->buf = buf;
+	pr->count = count;
+	pr->datatype = datatype;
+	pr->comm = comm;
+	*rbuf = buf;
+	*rcount = count;
+	*rtype = datatype;
+	if (enabled && pbMode == PB_DATATYPE) {
+		pr->ptype = clockType(buf, count, datatype, pr->stamp);
+		*rbuf = MPI_BOTTOM;
+		*rcount = 1;
+		*rtype = pr->ptype;
+	} else if (enabled) {
+		pr->packsize = packSize(count, datatype, comm);
+		pr->pool = localPool();
+		pr->packbuf = poolAcquire(pr->pool, pr->packsize);
+		*rbuf = pr->packbuf;
+		*rcount = pr->packsize;
+		*rtype = MPI_PACKED;
+	}
+	return pr;
+}
+
+/* Key the record on the handle MPI gave, or let it go if the call failed */
+static int trackRequest(PendingReq *pr, int result, MPI_Request *request) {
+	if (result != MPI_SUCCESS) {
+		if (pr->ptype != MPI_DATATYPE_NULL)
+			PMPI_Type_free(&pr->ptype);
+		if (pr->packbuf != NULL)
+			poolRelease(pr->pool, pr->packbuf);
+		recycleRequest(reqTable, pr);
+		return result;
+	}
+	pr->request = *request;
+	insertRequest(reqTable, pr);
+	return result;
+}
+
+/* MPI_Irecv Profiling Interface */
+int MPI_Irecv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Request *request) {
+	COUNT_CALL(CALL_Irecv);
+	if ((enabled || iterCnt.active) && source != MPI_PROC_NULL) {
+		// the clock lands in the pending record, merged when the receive completes
+		void *rbuf;
+		int rcount;
+		MPI_Datatype rtype;
+		PendingReq *pr = recvRecord(buf, count, datatype, source, comm, &rbuf, &rcount, &rtype);
+		return trackRequest(pr, PMPI_Irecv(rbuf, rcount, rtype, source, tag, comm, request), request);
+	} else {
+		return PMPI_Irecv(buf, count, datatype, source, tag, comm, request);
+	}
+}
 
-			// compare local clock and receiving clock
+/* MPI_Recv_init Profiling Interface : the record lives as long as the request */
+int MPI_Recv_init(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Request *request) {
+	COUNT_CALL(CALL_Recv_init);
+	if ((enabled || iterCnt.active) && source != MPI_PROC_NULL) {
+		void *rbuf;
+		int rcount;
+		MPI_Datatype rtype;
+		PendingReq *pr = recvRecord(buf, count, datatype, source, comm, &rbuf, &rcount, &rtype);
+		pr->persistent = 1;
+		return trackRequest(pr, PMPI_Recv_init(rbuf, rcount, rtype, source, tag, comm, request), request);
+	} else {
+		return PMPI_Recv_init(buf, count, datatype, source, tag, comm, request);
+	}
+}
 
-				// add appropriate receiving local clock to src-process queue & remove inappropriate receiving local clock
+/* Persistent send of any mode. The datatype points at the record's stamp, or
+   the request sends its staging buffer : MPI_Start stamps, and packs, again. */
+static int clockSendInit(IsendFn pinit, const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm, MPI_Request *request) {
+	if ((!enabled && !iterCnt.active) || dest == MPI_PROC_NULL)
+		return pinit(buf, count, datatype, dest, tag, comm, request);
+	int result;
+	PendingReq *pr = createRequest(reqTable);
+	pr->kind = REQ_SEND;
+	pr->persistent = 1;
+	pr->source = dest;
+	pr->buf = (void*) buf;
+	pr->count = count;
+	pr->datatype = datatype;
+	pr->comm = comm;
+	if (enabled && pbMode == PB_DATATYPE) {
+		pr->ptype = clockType(buf, count, datatype, pr->stamp);
+		result = pinit(MPI_BOTTOM, 1, pr->ptype, dest, tag, comm, request);
+	} else if (enabled) {
+		// the size is fixed now, both sides use the largest packing as in Sendrecv_replace
+		pr->packsize = packSize(count, datatype, comm);
+		pr->pool = localPool();
+		pr->packbuf = poolAcquire(pr->pool, pr->packsize);
+		result = pinit(pr->packbuf, pr->packsize, MPI_PACKED, dest, tag, comm, request);
+	} else {
+		result = pinit(buf, count, datatype, dest, tag, comm, request);
+	}
+	return trackRequest(pr, result, request);
+}
 
-				// remove selected receiving local clock for current receving event
-			manipulateCommProcs(controller, src, recvlclk, lclk, fresult);
+/* MPI_Send_init, MPI_Ssend_init, MPI_Bsend_init, MPI_Rsend_init Profiling Interface */
+#define PSEND_WRAPPER(name) \
+int MPI_##name(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm, MPI_Request *request) { \
+	COUNT_CALL(CALL_##name); \
+	return clockSendInit(PMPI_##name, buf, count, datatype, dest, tag, comm, request); \
+}
 
-			//printProcRecvs(controller, src);
+PSEND_CALLS(PSEND_WRAPPER)
 
-			int tempMem = getMemory();
-			maxMem = (tempMem > maxMem) ? tempMem : maxMem;
-			printf("%i KB \n", tempMem);
-			
-		} else {
-			lclk = (recvlclk > lclk) ? recvlclk : lclk;
-			/*printf("Enter");*/
-			/*printf("\nProcess %i (recv) : lclk = %i ", myrank, lclk);*/
-		}
-		return result;
+/* A persistent operation starts : a send takes the current stamp */
+static void startRequest(MPI_Request request) {
+	PendingReq *pr = findRequest(reqTable, request);
+	if (pr == NULL) return;
+	pr->active = 1;
+	if (pr->kind != REQ_SEND) return;
+	countSend(pr->comm, pr->source);
+	if (pr->ptype != MPI_DATATYPE_NULL) {
+		takeStamp(pr->stamp);
+	} else if (pr->packbuf != NULL) {
+		takeStamp(pr->stamp);
+		int pos = 0;
+		MPI_Pack (pr->buf, pr->count, pr->datatype, pr->packbuf, pr->packsize, &pos, pr->comm);
+		MPI_Pack (pr->stamp, stampLen, MPI_LONG_LONG_INT, pr->packbuf, pr->packsize, &pos, pr->comm);
+	}
+}
+
+/* MPI_Start Profiling Interface */
+int MPI_Start(MPI_Request *request) {
+	COUNT_CALL(CALL_Start);
+	startRequest(*request);
+	return PMPI_Start(request);
+}
+
+/* MPI_Startall Profiling Interface */
+int MPI_Startall(int count, MPI_Request array_of_requests[]) {
+	COUNT_CALL(CALL_Startall);
+	for (int i = 0; i < count && pendingRequests(reqTable) > 0; i++)
+		startRequest(array_of_requests[i]);
+	return PMPI_Startall(count, array_of_requests);
+}
+
+static Probed* probeEntry(MPI_Message message) {
+	return &probeCache[((unsigned long long) (unsigned long) message * 0x9E3779B97F4A7C15ULL) >> 60];
+}
+
+static void rememberProbe(MPI_Message message, int source, MPI_Comm comm) {
+	Probed *entry = probeEntry(message);
+	entry->message = message;
+	entry->source = source;
+	entry->comm = comm;
+}
+
+/* Where a matched message was probed. Unknown (another thread, or evicted) :
+   count it as a wildcard receive on MPI_COMM_WORLD */
+static void probedMessage(MPI_Message message, int *source, MPI_Comm *comm) {
+	Probed *entry = probeEntry(message);
+	*source = MPI_ANY_SOURCE;
+	*comm = MPI_COMM_WORLD;
+	if (entry->message == message && message != MPI_MESSAGE_NULL) {
+		*source = entry->source;
+		*comm = entry->comm;
+		entry->message = MPI_MESSAGE_NULL;
+	}
+}
+
+/* MPI_Probe Profiling Interface */
+int MPI_Probe(int source, int tag, MPI_Comm comm, MPI_Status *status) {
+	COUNT_CALL(CALL_Probe);
+	int result = PMPI_Probe(source, tag, comm, status);
+	if (enabled)
+		stripStamp(status, comm);
+	return result;
+}
+
+/* MPI_Iprobe Profiling Interface */
+int MPI_Iprobe(int source, int tag, MPI_Comm comm, int *flag, MPI_Status *status) {
+	COUNT_CALL(CALL_Iprobe);
+	int result = PMPI_Iprobe(source, tag, comm, flag, status);
+	if (enabled && *flag)
+		stripStamp(status, comm);
+	return result;
+}
+
+/* MPI_Mprobe Profiling Interface */
+int MPI_Mprobe(int source, int tag, MPI_Comm comm, MPI_Message *message, MPI_Status *status) {
+	COUNT_CALL(CALL_Mprobe);
+	int result = PMPI_Mprobe(source, tag, comm, message, status);
+	if (enabled)
+		stripStamp(status, comm);
+	rememberProbe(*message, source, comm);
+	return result;
+}
+
+/* MPI_Improbe Profiling Interface */
+int MPI_Improbe(int source, int tag, MPI_Comm comm, int *flag, MPI_Message *message, MPI_Status *status) {
+	COUNT_CALL(CALL_Improbe);
+	int result = PMPI_Improbe(source, tag, comm, flag, message, status);
+	if (*flag) {
+		if (enabled)
+			stripStamp(status, comm);
+		rememberProbe(*message, source, comm);
+	}
+	return result;
+}
+
+/* MPI_Mrecv Profiling Interface */
+int MPI_Mrecv(void *buf, int count, MPI_Datatype datatype, MPI_Message *message, MPI_Status *status) {
+	COUNT_CALL(CALL_Mrecv);
+	int source, result;
+	MPI_Comm comm;
+	probedMessage(*message, &source, &comm);
+	MPI_Status st;
+	if (status == MPI_STATUS_IGNORE) status = &st;
+	if (enabled && pbMode == PB_DATATYPE) {
+		long long stamp[MAX_STAMP] = {0};
+		MPI_Datatype ptype = clockType(buf, count, datatype, stamp);
+		result = PMPI_Mrecv(MPI_BOTTOM, 1, ptype, message, status);
+		payloadStatus(status, ptype, datatype);
+		PMPI_Type_free(&ptype);
+		recvEvent(source, status, stamp);
+	} else if (enabled) {
+		long long stamp[MAX_STAMP] = {0};
+		int num = packSize(count, datatype, comm);
+		char *packbuf = poolAcquire(localPool(), num);
+		result = PMPI_Mrecv(packbuf, num, MPI_PACKED, message, status);
+		// MPI_MESSAGE_NO_PROC brings nothing, buf must stay as it was
+		if (status->MPI_SOURCE != MPI_PROC_NULL)
+			unpackMessage(packbuf, num, buf, count, datatype, stamp, comm);
+		stripStamp(status, comm);
+		poolRelease(localPool(), packbuf);
+		recvEvent(source, status, stamp);
+	} else {
+		result = PMPI_Mrecv(buf, count, datatype, message, status);
+	}
+	countRecv(comm, status->MPI_SOURCE);
+	return result;
+}
+
+/* MPI_Imrecv Profiling Interface */
+int MPI_Imrecv(void *buf, int count, MPI_Datatype datatype, MPI_Message *message, MPI_Request *request) {
+	COUNT_CALL(CALL_Imrecv);
+	int source;
+	MPI_Comm comm;
+	probedMessage(*message, &source, &comm);
+	if (enabled || iterCnt.active) {
+		void *rbuf;
+		int rcount;
+		MPI_Datatype rtype;
+		PendingReq *pr = recvRecord(buf, count, datatype, source, comm, &rbuf, &rcount, &rtype);
+		return trackRequest(pr, PMPI_Imrecv(rbuf, rcount, rtype, message, request), request);
 	} else {
-		return PMPI_Recv(buf, count, datatype, source, tag, comm, status);
+		return PMPI_Imrecv(buf, count, datatype, message, request);
 	}
 }
 
-/*int MPI_Irecv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Request *request) {
+/* MPI_Sendrecv Profiling Interface */
+int MPI_Sendrecv(const void *sendbuf, int sendcount, MPI_Datatype sendtype, int dest, int sendtag,
+		void *recvbuf, int recvcount, MPI_Datatype recvtype, int source, int recvtag, MPI_Comm comm, MPI_Status *status) {
+	COUNT_CALL(CALL_Sendrecv);
+	countSend(comm, dest);
 	int result;
-	numRecv++;
-		
-	result = PMPI_Irecv(buf, count, type, src, tag, comm, request);
-	//printf("MPI_SOURCE = %d\n", status->MPI_SOURCE); 
-	//sumSrc ^= (Drank + status->MPI_SOURCE);
+	MPI_Status st;
+	if (status == MPI_STATUS_IGNORE) status = &st;
+	if (enabled && pbMode == PB_DATATYPE) {
+		long long sendstamp[MAX_STAMP];
+		takeStamp(sendstamp);
+		long long stamp[MAX_STAMP] = {0};
+		MPI_Datatype stype = clockType(sendbuf, sendcount, sendtype, sendstamp);
+		MPI_Datatype rtype = clockType(recvbuf, recvcount, recvtype, stamp);
+		result = PMPI_Sendrecv(MPI_BOTTOM, 1, stype, dest, sendtag, MPI_BOTTOM, 1, rtype, source, recvtag, comm, status);
+		payloadStatus(status, rtype, recvtype);
+		PMPI_Type_free(&stype);
+		PMPI_Type_free(&rtype);
+		recvEvent(source, status, stamp);
+	} else if (enabled) {
+		long long stamp[MAX_STAMP];
+		takeStamp(stamp);
+		int packsize;
+		char *sendpack = packMessage(sendbuf, sendcount, sendtype, stamp, comm, &packsize);
+		int num = packSize(recvcount, recvtype, comm);
+		char *recvpack = poolAcquire(localPool(), num);
+		result = PMPI_Sendrecv(sendpack, packsize, MPI_PACKED, dest, sendtag, recvpack, num, MPI_PACKED, source, recvtag, comm, status);
+		if (status->MPI_SOURCE != MPI_PROC_NULL)
+			unpackMessage(recvpack, num, recvbuf, recvcount, recvtype, stamp, comm);
+		stripStamp(status, comm);
+		poolRelease(localPool(), sendpack);
+		poolRelease(localPool(), recvpack);
+		recvEvent(source, status, stamp);
+	} else {
+		result = PMPI_Sendrecv(sendbuf, sendcount, sendtype, dest, sendtag, recvbuf, recvcount, recvtype, source, recvtag, comm, status);
+	}
+	countRecv(comm, status->MPI_SOURCE);
+	return result;
+}
+
+/* MPI_Sendrecv_replace Profiling Interface : the stamp is replaced along with the payload */
+int MPI_Sendrecv_replace(void *buf, int count, MPI_Datatype datatype, int dest, int sendtag,
+		int source, int recvtag, MPI_Comm comm, MPI_Status *status) {
+	COUNT_CALL(CALL_Sendrecv_replace);
+	countSend(comm, dest);
+	int result;
+	MPI_Status st;
+	if (status == MPI_STATUS_IGNORE) status = &st;
+	if (enabled && pbMode == PB_DATATYPE) {
+		long long stamp[MAX_STAMP];
+		takeStamp(stamp);
+		MPI_Datatype ptype = clockType(buf, count, datatype, stamp);
+		result = PMPI_Sendrecv_replace(MPI_BOTTOM, 1, ptype, dest, sendtag, source, recvtag, comm, status);
+		payloadStatus(status, ptype, datatype);
+		PMPI_Type_free(&ptype);
+		recvEvent(source, status, stamp);
+	} else if (enabled) {
+		long long stamp[MAX_STAMP];
+		takeStamp(stamp);
+		int packsize;
+		int num = packSize(count, datatype, comm);
+		char *packbuf = packMessage(buf, count, datatype, stamp, comm, &packsize);
+		// both sides send what they can receive, the packed sizes must not matter
+		result = PMPI_Sendrecv_replace(packbuf, num, MPI_PACKED, dest, sendtag, source, recvtag, comm, status);
+		if (status->MPI_SOURCE != MPI_PROC_NULL)
+			unpackMessage(packbuf, num, buf, count, datatype, stamp, comm);
+		stripStamp(status, comm);
+		poolRelease(localPool(), packbuf);
+		recvEvent(source, status, stamp);
+	} else {
+		result = PMPI_Sendrecv_replace(buf, count, datatype, dest, sendtag, source, recvtag, comm, status);
+	}
+	countRecv(comm, status->MPI_SOURCE);
+	return result;
+}
+
+/* Finish the piggyback part of an operation MPI reported as complete */
+static void completeRequest(PendingReq *pr, MPI_Status *status) {
+	// an inactive persistent request completes at once, with an empty status
+	if (pr->persistent && !pr->active) return;
+	pr->active = 0;
+	if (pr->kind == REQ_RECV) {
+		// MPI_Cancel is not wrapped : a cancelled receive still completes here,
+		// its record goes but it brings no clock
+		int cancelled = 0;
+		PMPI_Test_cancelled(status, &cancelled);
+		int clocked = (pr->ptype != MPI_DATATYPE_NULL || pr->packbuf != NULL);
+		if (pr->ptype != MPI_DATATYPE_NULL) {
+			payloadStatus(status, pr->ptype, pr->datatype);
+			if (!pr->persistent)
+				PMPI_Type_free(&pr->ptype);
+		} else if (pr->packbuf != NULL && !cancelled && status->MPI_SOURCE != MPI_PROC_NULL) {
+			unpackMessage(pr->packbuf, pr->packsize, pr->buf, pr->count, pr->datatype, pr->stamp, pr->comm);
+			stripStamp(status, pr->comm);
+		}
+		if (!cancelled) {
+			if (clocked)
+				recvEvent(pr->source, status, pr->stamp);
+			countRecv(pr->comm, status->MPI_SOURCE);
+		}
+	}
+	// MPI_Start uses it again, MPI_Request_free lets go of it
+	if (pr->persistent) return;
+	if (pr->packbuf != NULL)
+		poolRelease(pr->pool, pr->packbuf);
+	removeRequest(reqTable, pr);
+}
+
+/* MPI_Wait Profiling Interface */
+int MPI_Wait(MPI_Request *request, MPI_Status *status) {
+	COUNT_CALL(CALL_Wait);
+	PendingReq *pr = findRequest(reqTable, *request);
+	if (pr == NULL)
+		return PMPI_Wait(request, status);
+	MPI_Status st;
+	if (status == MPI_STATUS_IGNORE) status = &st;
+	int result = PMPI_Wait(request, status);
+	completeRequest(pr, status);
+	return result;
+}
+
+/* MPI_Test Profiling Interface */
+int MPI_Test(MPI_Request *request, int *flag, MPI_Status *status) {
+	COUNT_CALL(CALL_Test);
+	PendingReq *pr = findRequest(reqTable, *request);
+	if (pr == NULL)
+		return PMPI_Test(request, flag, status);
+	MPI_Status st;
+	if (status == MPI_STATUS_IGNORE) status = &st;
+	int result = PMPI_Test(request, flag, status);
+	if (*flag)
+		completeRequest(pr, status);
+	return result;
+}
+
+/* Pending records and statuses of a request array, on the stack for the usual small arrays */
+#define REQ_STACK	64
+
+typedef struct {
+	PendingReq *stackPending[REQ_STACK];
+	MPI_Status stackStatus[REQ_STACK];
+	PendingReq **pending;
+	MPI_Status *statuses;
+	int found;
+} ReqArray;
+
+static void lookupRequests(ReqArray *ra, int count, MPI_Request array_of_requests[], MPI_Status statuses[]) {
+	ra->pending = (count > REQ_STACK) ? (PendingReq**) malloc(count * sizeof(PendingReq*)) : ra->stackPending;
+	ra->found = 0;
+	for (int i = 0; i < count; i++) {
+		ra->pending[i] = findRequest(reqTable, array_of_requests[i]);
+		if (ra->pending[i] != NULL) ra->found++;
+	}
+	ra->statuses = statuses;
+	if (statuses == MPI_STATUSES_IGNORE)
+		ra->statuses = (count > REQ_STACK) ? (MPI_Status*) malloc(count * sizeof(MPI_Status)) : ra->stackStatus;
+}
+
+static void releaseRequests(ReqArray *ra, MPI_Status statuses[]) {
+	if (ra->pending != ra->stackPending) free(ra->pending);
+	if (ra->statuses != statuses && ra->statuses != ra->stackStatus) free(ra->statuses);
+}
+
+/* MPI_Waitall Profiling Interface */
+int MPI_Waitall(int count, MPI_Request array_of_requests[], MPI_Status array_of_statuses[]) {
+	COUNT_CALL(CALL_Waitall);
+	if (pendingRequests(reqTable) == 0)
+		return PMPI_Waitall(count, array_of_requests, array_of_statuses);
+	ReqArray ra;
+	lookupRequests(&ra, count, array_of_requests, array_of_statuses);
+	int result = PMPI_Waitall(count, array_of_requests, ra.statuses);
+	for (int i = 0; i < count && ra.found > 0; i++) {
+		if (ra.pending[i] != NULL)
+			completeRequest(ra.pending[i], &ra.statuses[i]);
+	}
+	releaseRequests(&ra, array_of_statuses);
+	return result;
+}
+
+/* MPI_Testall Profiling Interface */
+int MPI_Testall(int count, MPI_Request array_of_requests[], int *flag, MPI_Status array_of_statuses[]) {
+	COUNT_CALL(CALL_Testall);
+	if (pendingRequests(reqTable) == 0)
+		return PMPI_Testall(count, array_of_requests, flag, array_of_statuses);
+	ReqArray ra;
+	lookupRequests(&ra, count, array_of_requests, array_of_statuses);
+	int result = PMPI_Testall(count, array_of_requests, flag, ra.statuses);
+	for (int i = 0; i < count && *flag && ra.found > 0; i++) {
+		if (ra.pending[i] != NULL)
+			completeRequest(ra.pending[i], &ra.statuses[i]);
+	}
+	releaseRequests(&ra, array_of_statuses);
+	return result;
+}
+
+/* MPI_Waitany Profiling Interface */
+int MPI_Waitany(int count, MPI_Request array_of_requests[], int *index, MPI_Status *status) {
+	COUNT_CALL(CALL_Waitany);
+	if (pendingRequests(reqTable) == 0)
+		return PMPI_Waitany(count, array_of_requests, index, status);
+	ReqArray ra;
+	lookupRequests(&ra, count, array_of_requests, MPI_STATUSES_IGNORE);
+	MPI_Status st;
+	if (status == MPI_STATUS_IGNORE) status = &st;
+	int result = PMPI_Waitany(count, array_of_requests, index, status);
+	if (*index != MPI_UNDEFINED && ra.pending[*index] != NULL)
+		completeRequest(ra.pending[*index], status);
+	releaseRequests(&ra, MPI_STATUSES_IGNORE);
+	return result;
+}
+
+/* MPI_Testany Profiling Interface */
+int MPI_Testany(int count, MPI_Request array_of_requests[], int *index, int *flag, MPI_Status *status) {
+	COUNT_CALL(CALL_Testany);
+	if (pendingRequests(reqTable) == 0)
+		return PMPI_Testany(count, array_of_requests, index, flag, status);
+	ReqArray ra;
+	lookupRequests(&ra, count, array_of_requests, MPI_STATUSES_IGNORE);
+	MPI_Status st;
+	if (status == MPI_STATUS_IGNORE) status = &st;
+	int result = PMPI_Testany(count, array_of_requests, index, flag, status);
+	if (*flag && *index != MPI_UNDEFINED && ra.pending[*index] != NULL)
+		completeRequest(ra.pending[*index], status);
+	releaseRequests(&ra, MPI_STATUSES_IGNORE);
+	return result;
+}
+
+/* Completed requests of Waitsome / Testsome, statuses are in completion order */
+static void completeSome(ReqArray *ra, int outcount, int array_of_indices[]) {
+	for (int k = 0; k < outcount && outcount != MPI_UNDEFINED && ra->found > 0; k++) {
+		if (ra->pending[array_of_indices[k]] != NULL)
+			completeRequest(ra->pending[array_of_indices[k]], &ra->statuses[k]);
+	}
+}
+
+/* MPI_Waitsome Profiling Interface */
+int MPI_Waitsome(int incount, MPI_Request array_of_requests[], int *outcount, int array_of_indices[], MPI_Status array_of_statuses[]) {
+	COUNT_CALL(CALL_Waitsome);
+	if (pendingRequests(reqTable) == 0)
+		return PMPI_Waitsome(incount, array_of_requests, outcount, array_of_indices, array_of_statuses);
+	ReqArray ra;
+	lookupRequests(&ra, incount, array_of_requests, array_of_statuses);
+	int result = PMPI_Waitsome(incount, array_of_requests, outcount, array_of_indices, ra.statuses);
+	completeSome(&ra, *outcount, array_of_indices);
+	releaseRequests(&ra, array_of_statuses);
 	return result;
-}*/
+}
+
+/* MPI_Testsome Profiling Interface */
+int MPI_Testsome(int incount, MPI_Request array_of_requests[], int *outcount, int array_of_indices[], MPI_Status array_of_statuses[]) {
+	COUNT_CALL(CALL_Testsome);
+	if (pendingRequests(reqTable) == 0)
+		return PMPI_Testsome(incount, array_of_requests, outcount, array_of_indices, array_of_statuses);
+	ReqArray ra;
+	lookupRequests(&ra, incount, array_of_requests, array_of_statuses);
+	int result = PMPI_Testsome(incount, array_of_requests, outcount, array_of_indices, ra.statuses);
+	completeSome(&ra, *outcount, array_of_indices);
+	releaseRequests(&ra, array_of_statuses);
+	return result;
+}
+
+/* MPI_Request_free Profiling Interface. The operation may still be in flight
+   and MPI may still read or write its stamp and staging buffer, so the record
+   leaves the table but is never reused. A freed receive brings no clock.
+   An inactive persistent request has nothing in flight, its record is reused. */
+int MPI_Request_free(MPI_Request *request) {
+	COUNT_CALL(CALL_Request_free);
+	PendingReq *pr = findRequest(reqTable, *request);
+	if (pr != NULL) {
+		// MPI keeps the datatype alive until the operation is done
+		if (pr->ptype != MPI_DATATYPE_NULL)
+			PMPI_Type_free(&pr->ptype);
+		if (pr->persistent && !pr->active) {
+			if (pr->packbuf != NULL)
+				poolRelease(pr->pool, pr->packbuf);
+			removeRequest(reqTable, pr);
+		} else {
+			detachRequest(reqTable, pr);
+		}
+	}
+	return PMPI_Request_free(request);
+}
+
+/* Non-empty data for this rank : it cannot leave the collective before the
+   members sending it entered */
+static inline int hasData(int count, MPI_Datatype datatype) {
+	int size = 0;
+	if (count <= 0) return 0;
+	PMPI_Type_size(datatype, &size);
+	return size > 0;
+}
 
+/* Collectives on MPI_COMM_WORLD that can only spread the root's clock are an
+   epoch, nothing travels. 1 if the collective was one. A member that may leave
+   before the root reaches the collective (no data from it) would carry an epoch
+   the root's clock does not match yet : synced must be set. */
+static int lazyCollective(int flow, int root, MPI_Comm comm, int synced) {
+	if (comm != MPI_COMM_WORLD || !synced)
+		return 0;
+	if (flow == FLOW_ALL || (flow == FLOW_FROM_ROOT && numRoots == 1 && root == rootrecv)) {
+		epochEvent();
+		return 1;
+	}
+	return 0;
+}
+
+/* After any other collective, the members merge the stamps its data flow would
+   have carried to them : one small collective of the same shape */
+static void mergeCollective(int flow, int root, MPI_Comm comm) {
+	long long stamp[MAX_STAMP];
+	takeStamp(stamp);
+	int rank;
+	switch (flow) {
+	case FLOW_ALL:
+		PMPI_Allreduce(MPI_IN_PLACE, stamp, stampLen, MPI_LONG_LONG_INT, MPI_MAX, comm);
+		break;
+	case FLOW_TO_ROOT:
+		// nothing the only root of the detection could learn
+		if (numRoots == 1 && worldRank(comm, root) == rootrecv)
+			return;
+		PMPI_Comm_rank(comm, &rank);
+		PMPI_Reduce((rank == root) ? MPI_IN_PLACE : stamp, stamp, stampLen, MPI_LONG_LONG_INT, MPI_MAX, root, comm);
+		break;
+	case FLOW_FROM_ROOT:
+		PMPI_Bcast(stamp, stampLen, MPI_LONG_LONG_INT, root, comm);
+		break;
+	case FLOW_PREFIX:
+		PMPI_Scan(MPI_IN_PLACE, stamp, stampLen, MPI_LONG_LONG_INT, MPI_MAX, comm);
+		break;
+	}
+	mergeStamp(stamp);
+}
+
+/* Collectives of the COLLECTIVES table. A separate stamp-sized collective is
+   cheaper than piggybacking on these : the payload would need a user-defined
+   op or a copy, and the library loses its tuned algorithms. Intercommunicators
+   are passed through. */
+#define COLLECTIVE_WRAPPER(name, flow, params, args, root, synced) \
+int MPI_##name params { \
+	COUNT_CALL(CALL_##name); \
+	if (!enabled || interComm(comm) || lazyCollective(flow, root, comm, synced)) \
+		return PMPI_##name args; \
+	int rt = PMPI_##name args; \
+	mergeCollective(flow, root, comm); \
+	return rt; \
+}
+
+COLLECTIVES(COLLECTIVE_WRAPPER)
+
+/* Deadlocks found and receiving events of every root, summed at rank 0 */
+static void sumVerdicts(long long *sums) {
+	long long found[2] = {0, 0};
+	if (myRoot >= 0) {
+		found[0] = deadlocksFound(controller);
+		found[1] = __atomic_load_n(&vclk[myRoot], __ATOMIC_RELAXED);
+	}
+	PMPI_Reduce(found, sums, 2, MPI_LONG_LONG_INT, MPI_SUM, rootrecv, MPI_COMM_WORLD);
+}
+
+/* Every checkpointEvery-th barrier on MPI_COMM_WORLD, report what the roots
+   found so far. The helper threads may still be behind their receives. */
+static void checkpoint() {
+	long long sums[2];
+	if (checkpointEvery <= 0 || ++worldBarriers % checkpointEvery != 0)
+		return;
+	sumVerdicts(sums);
+	if (myrank == rootrecv)
+		printf("Checkpoint %lld : %lld deadlocks over %d roots, %lld receiving events\n",
+				worldBarriers / checkpointEvery, sums[0], numRoots, sums[1]);
+}
+
+/* A barrier is only there to merge the clocks. On MPI_COMM_WORLD it only spreads
+   the roots' clocks : count an epoch. Elsewhere the max allreduce of the stamps
+   synchronizes the members just as well, so it replaces the barrier. */
 int MPI_Barrier(MPI_Comm comm) {
-	int rt = PMPI_Barrier(comm);
-	if (enabled) {
-		/*printf("\nProcess %i (barrier) : lclk = %i ", myrank, lclk);*/
-		PMPI_Allreduce(&lclk, &lclk, 1, MPI_LONG_LONG_INT, MPI_MAX, comm);
-		/*printf("lclkafter = %i ", lclk);*/
+	COUNT_CALL(CALL_Barrier);
+	if (!enabled || interComm(comm))
+		return PMPI_Barrier(comm);
+	if (lazyCollective(FLOW_ALL, 0, comm, 1)) {
+		int rt = PMPI_Barrier(comm);
+		checkpoint();
+		return rt;
 	}
+	long long stamp[MAX_STAMP];
+	takeStamp(stamp);
+	int rt = PMPI_Allreduce(MPI_IN_PLACE, stamp, stampLen, MPI_LONG_LONG_INT, MPI_MAX, comm);
+	mergeStamp(stamp);
 	return rt;
 }
 
+/* A bcast of the root on MPI_COMM_WORLD is an epoch. Otherwise the bcast root's
+   stamp travels with the payload, the members merge it on arrival */
 int MPI_Bcast(void *buffer, int count, MPI_Datatype datatype, int root, MPI_Comm comm) {
-	int rt = PMPI_Bcast(buffer, count, datatype, root, comm);
-	if (enabled) {
-		/*printf("\nProcess %i (bcast) : lclk = %i ", myrank, lclk);*/
-		PMPI_Allreduce(&lclk, &lclk, 1, MPI_LONG_LONG_INT, MPI_MAX, comm);
-		/*printf("lclkafter = %i ", lclk);*/
-	}
+	COUNT_CALL(CALL_Bcast);
+	if (!enabled || interComm(comm))
+		return PMPI_Bcast(buffer, count, datatype, root, comm);
+	if (lazyCollective(FLOW_FROM_ROOT, root, comm, hasData(count, datatype)))
+		return PMPI_Bcast(buffer, count, datatype, root, comm);
+	long long stamp[MAX_STAMP];
+	takeStamp(stamp);
+	MPI_Datatype ptype = clockType(buffer, count, datatype, stamp);
+	int rt = PMPI_Bcast(MPI_BOTTOM, 1, ptype, root, comm);
+	PMPI_Type_free(&ptype);
+	mergeStamp(stamp);
 	return rt;
 }
 
-int MPI_Reduce(void *sendbuf, void *recvbuf, int count, MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm) {
-	int rt = PMPI_Reduce(sendbuf, recvbuf, count, datatype, op, root, comm);
-	if (enabled) 
-		PMPI_Allreduce(&lclk, &lclk, 1, MPI_LONG_LONG_INT, MPI_MAX, comm);
-	return rt;
+/* A freed handle may be reused for a different type : forget the packed sizes,
+   in every thread */
+int MPI_Type_free(MPI_Datatype *datatype) {
+	__atomic_add_fetch(&typeGen, 1, __ATOMIC_RELEASE);
+	return PMPI_Type_free(datatype);
+}
+
+/* Same for communicators : drop the cached rank translations */
+int MPI_Comm_free(MPI_Comm *comm) {
+	__atomic_add_fetch(&commGen, 1, __ATOMIC_RELEASE);
+	return PMPI_Comm_free(comm);
 }
 
 /* MPI_Finalize Profiling Interface */
@@ -154,29 +1129,81 @@ int MPI_Finalize() {
 		PMPI_Barrier(MPI_COMM_WORLD);
 		int i;
 		if (myrank == rootrecv) {
-			/*for(int i = 0; i < size; i++) {
+			// let the helper thread catch up with every receive
+			stopAnalyzer(analyzer);
+			logFlush();
+			/*for(int i = 0; i < nprocs; i++) {
 				printProcRecvs(controller, i);
 			}*/
 			printRootRecvs(controller);
 			
 			/*fprintf(fresult, "\n");*/
 			printf("\n\n-------------------------------DEADLOCK DETECTION RESULT------------------------------\n");
-			for(i = 0; i < size; i++) {
+			for(i = 0; i < nprocs; i++) {
 				if (i != rootrecv) 
 					checkRemainQueue(controller, i, fresult);
 			}
 			/*fprintf(fresult, "\n");*/
 			fclose(fresult);
 			printf("\n\n--------------------------------------SUMMARY-----------------------------------------\n");
-			printf("\nNumber of receiving event on ROOT PROCESS : %i ", lclk);
-			printf("\nMax Memory Consuming : %i KB", maxMem);
+			printf("\nNumber of receiving event on ROOT PROCESS : %lld ", vclk[myRoot]);
+			// one last sample so short runs still report a peak
+			setMemorySampling(1);
+			sampleMemory();
+			printf("\nMax Memory Consuming : %i KB", peakMemory());
+			printf("\nPeak Tool Memory : %lld KB", (peakToolMemory() + 1023) >> 10);
+			printf("\nPeak Application Memory : %i KB", peakAppMemory());
 			printf("\n");
+		} else if (myRoot >= 0) {
+			stopAnalyzer(analyzer);
+			for (i = 0; i < nprocs; i++) {
+				if (i != myrank)
+					drainQueue(controller, i, fresult);
+			}
+			fclose(fresult);
 		}
+		if (numRoots > 1) {
+			long long sums[2];
+			sumVerdicts(sums);
+			if (myrank == rootrecv)
+				printf("Deadlocks over %d roots : %lld, receiving events : %lld\n", numRoots, sums[0], sums[1]);
+		}
+	}
+	// every rank, not only the root : inline analysis on other roots logs too
+	logFlush();
+	long long stats[3] = {0, 0, 0}, sums[2], peak;
+	int n = __atomic_load_n(&numPools, __ATOMIC_ACQUIRE);
+	for (int i = 0; i < n && i < MAX_THREADS; i++) {
+		long long st[3];
+		poolStats(pools[i], st);
+		for (int k = 0; k < 3; k++)
+			stats[k] += st[k];
+	}
+	PMPI_Reduce(stats, sums, 2, MPI_LONG_LONG_INT, MPI_SUM, rootrecv, MPI_COMM_WORLD);
+	PMPI_Reduce(&stats[2], &peak, 1, MPI_LONG_LONG_INT, MPI_MAX, rootrecv, MPI_COMM_WORLD);
+	if (myrank == rootrecv && sums[0] > 0)
+		printf("Buffer Pool : %lld acquires, hit rate %.2f %%, peak footprint %lld KB per process\n",
+				sums[0], 100.0 * sums[1] / sums[0], (peak + 1023) >> 10);
+	long long calls[CALL_KINDS];
+	PMPI_Reduce(callCount, calls, CALL_KINDS, MPI_LONG_LONG_INT, MPI_SUM, rootrecv, MPI_COMM_WORLD);
+	if (myrank == rootrecv) {
+		printf("MPI Calls :");
+		for (int k = 0; k < CALL_KINDS; k++) {
+			if (calls[k] > 0)
+				printf(" %s %lld", callNames[k], calls[k]);
+		}
+		printf("\n");
 	}
 	cTime = MPI_Wtime() - cTime;
 	double maxTime;
 	PMPI_Reduce(&cTime, &maxTime, 1, MPI_DOUBLE, MPI_MAX, rootrecv, MPI_COMM_WORLD);
 	if (myrank == rootrecv)
 		printf("Max Consuming Time : %f \n", maxTime);
+	if (enabled) {
+		for (int i = 0; i * EPOCH_CHUNK < numEpochClocks; i++) {
+			memFree(EPOCH_CHUNK * sizeof(EpochClock));
+			free(epochChunks[i]);
+		}
+	}
 	return PMPI_Finalize();
 }
\ No newline at end of file
@@ -0,0 +1,133 @@
+#include "Pool.h"
+
+Pool::Pool(long long limit):
+limit(limit),
+cached(0),
+footprint(0),
+peak(0),
+gets(0),
+hits(0)
+{
+	remote = NULL;
+	owner = pthread_self();
+	for (int i = 0; i < POOL_CLASSES; i++)
+		freeLists[i] = NULL;
+}
+
+Pool::~Pool() {
+	PoolHeader* hdr;
+	while (remote != NULL) {
+		hdr = remote;
+		remote = hdr->next;
+		int bytes = (hdr->cls < 0) ? hdr->size : 1 << (hdr->cls + POOL_MIN_SHIFT);
+		memFree(sizeof(PoolHeader) + bytes);
+		free(hdr);
+	}
+	for (int i = 0; i < POOL_CLASSES; i++) {
+		while (freeLists[i] != NULL) {
+			hdr = freeLists[i];
+			freeLists[i] = hdr->next;
+			memFree(sizeof(PoolHeader) + (1 << (i + POOL_MIN_SHIFT)));
+			free(hdr);
+		}
+	}
+}
+
+/* Take back the buffers other threads released */
+void Pool::reclaim() {
+	PoolHeader* hdr = __atomic_exchange_n(&remote, (PoolHeader*) NULL, __ATOMIC_ACQUIRE);
+	while (hdr != NULL) {
+		PoolHeader* next = hdr->next;
+		release((char*) (hdr + 1));
+		hdr = next;
+	}
+}
+
+char* Pool::acquire(int size) {
+	PoolHeader* hdr;
+	int cls = 0;
+	gets++;
+	if (__atomic_load_n(&remote, __ATOMIC_RELAXED) != NULL)
+		reclaim();
+	while (cls < POOL_CLASSES && (1 << (cls + POOL_MIN_SHIFT)) < size)
+		cls++;
+	if (cls == POOL_CLASSES) {
+		/* too large to be worth keeping around */
+		hdr = (PoolHeader*) malloc(sizeof(PoolHeader) + size);
+		hdr->cls = -1;
+		footprint += size;
+		memAlloc(sizeof(PoolHeader) + size);
+	} else if (freeLists[cls] != NULL) {
+		hits++;
+		hdr = freeLists[cls];
+		freeLists[cls] = hdr->next;
+		cached -= 1 << (cls + POOL_MIN_SHIFT);
+	} else {
+		hdr = (PoolHeader*) malloc(sizeof(PoolHeader) + (1 << (cls + POOL_MIN_SHIFT)));
+		hdr->cls = cls;
+		footprint += 1 << (cls + POOL_MIN_SHIFT);
+		memAlloc(sizeof(PoolHeader) + (1 << (cls + POOL_MIN_SHIFT)));
+	}
+	hdr->next = NULL;
+	hdr->size = size;
+	peak = (footprint > peak) ? footprint : peak;
+	return (char*) (hdr + 1);
+}
+
+void Pool::release(char* buf) {
+	if (buf == NULL) return;
+	PoolHeader* hdr = ((PoolHeader*) buf) - 1;
+	if (!pthread_equal(pthread_self(), owner)) {
+		/* the free lists and counters belong to the owner */
+		hdr->next = __atomic_load_n(&remote, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&remote, &hdr->next, hdr, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+		return;
+	}
+	if (hdr->cls < 0) {
+		footprint -= hdr->size;
+		memFree(sizeof(PoolHeader) + hdr->size);
+		free(hdr);
+		return;
+	}
+	long long bytes = 1 << (hdr->cls + POOL_MIN_SHIFT);
+	if (cached + bytes > limit) {
+		/* over the high-water mark : give the memory back */
+		footprint -= bytes;
+		memFree(sizeof(PoolHeader) + bytes);
+		free(hdr);
+	} else {
+		hdr->next = freeLists[hdr->cls];
+		freeLists[hdr->cls] = hdr;
+		cached += bytes;
+	}
+}
+
+long long Pool::getGets() {
+	return gets;
+}
+
+long long Pool::getHits() {
+	return hits;
+}
+
+long long Pool::getPeak() {
+	return peak;
+}
+
+void initPool(Pool** pool, long long limit) {
+	(*pool) = new Pool(limit);
+}
+
+char* poolAcquire(Pool* pool, int size) {
+	return pool->acquire(size);
+}
+
+void poolRelease(Pool* pool, char* buf) {
+	pool->release(buf);
+}
+
+void poolStats(Pool* pool, long long* stats) {
+	stats[0] = pool->getGets();
+	stats[1] = pool->getHits();
+	stats[2] = pool->getPeak();
+}
@@ -0,0 +1,26 @@
+#include "RecvRanges.h"
+
+RecvRanges::RecvRanges() {}
+
+RecvRanges::~RecvRanges() {}
+
+/* clocks are pushed in increasing order */
+void RecvRanges::push(int clock) {
+	if (!ranges.empty() && ranges.back().hi + 1 == clock) {
+		ranges.back().hi = clock;
+	} else {
+		ClockRange r = {clock, clock};
+		ranges.push_back(r);
+		/* counted per run, the deque's own blocks are left out */
+		memAlloc(sizeof(ClockRange));
+	}
+}
+
+void RecvRanges::pop() {
+	if (ranges.front().lo == ranges.front().hi) {
+		ranges.pop_front();
+		memFree(sizeof(ClockRange));
+	}
+	else
+		ranges.front().lo++;
+}
@@ -0,0 +1,47 @@
+#include "RecvWindow.h"
+
+RecvWindow::RecvWindow():
+base(1),
+first(1),
+next(1),
+spare(NULL)
+{}
+
+RecvWindow::~RecvWindow() {
+	for (unsigned i = 0; i < chunks.size(); i++)
+		free(chunks[i]);
+	memFree((chunks.size() + (spare != NULL)) * WINDOW_CHUNK * sizeof(int));
+	free(spare);
+}
+
+void RecvWindow::append(int from) {
+	int off = next - base;
+	if ((off >> WINDOW_SHIFT) == (int) chunks.size()) {
+		int* chunk = spare;
+		spare = NULL;
+		if (chunk == NULL) {
+			chunk = (int*) malloc(WINDOW_CHUNK * sizeof(int));
+			memAlloc(WINDOW_CHUNK * sizeof(int));
+		}
+		chunks.push_back(chunk);
+	}
+	/* appends are sequential : the slot is always in the last chunk */
+	chunks.back()[off & (WINDOW_CHUNK - 1)] = from;
+	next++;
+}
+
+/* forget every receive with clock <= clock */
+void RecvWindow::dropTo(int clock) {
+	if (clock < first) return;
+	first = (clock + 1 < next) ? clock + 1 : next;
+	while (!chunks.empty() && first - base >= WINDOW_CHUNK) {
+		if (spare == NULL)
+			spare = chunks.front();
+		else {
+			free(chunks.front());
+			memFree(WINDOW_CHUNK * sizeof(int));
+		}
+		chunks.pop_front();
+		base += WINDOW_CHUNK;
+	}
+}
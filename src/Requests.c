@@ -0,0 +1,195 @@
+#include "Requests.h"
+
+/* Records a thread freed, reused by its next operation without the lock */
+static __thread PendingReq* threadFree = NULL;
+
+RequestTable::RequestTable():
+bits(6),
+used(0),
+freeList(NULL),
+shared(0)
+{
+	pthread_mutex_init(&mutex, NULL);
+	slots = (PendingReq**) calloc(1u << bits, sizeof(PendingReq*));
+	memAlloc((1u << bits) * sizeof(PendingReq*));
+}
+
+RequestTable::~RequestTable() {
+	free(slots);
+	for (unsigned i = 0; i < chunks.size(); i++)
+		free(chunks[i]);
+	memFree((1u << bits) * sizeof(PendingReq*) + chunks.size() * REQ_CHUNK * sizeof(PendingReq));
+}
+
+unsigned RequestTable::home(MPI_Request request) {
+	/* handles are pointers or small integers depending on the MPI library */
+	unsigned long long key = (unsigned long long) (unsigned long) request;
+	return (unsigned) ((key * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+void RequestTable::grow() {
+	PendingReq** old = slots;
+	unsigned oldSize = 1u << bits;
+	bits++;
+	slots = (PendingReq**) calloc(1u << bits, sizeof(PendingReq*));
+	memAlloc(oldSize * sizeof(PendingReq*));
+	unsigned mask = (1u << bits) - 1;
+	for (unsigned i = 0; i < oldSize; i++) {
+		if (old[i] != NULL) {
+			unsigned j = home(old[i]->request);
+			while (slots[j] != NULL) j = (j + 1) & mask;
+			slots[j] = old[i];
+		}
+	}
+	free(old);
+}
+
+PendingReq* RequestTable::create() {
+	if (shared && threadFree != NULL) {
+		PendingReq* pr = threadFree;
+		threadFree = pr->next;
+		pr->next = NULL;
+		pr->ptype = MPI_DATATYPE_NULL;
+		pr->packbuf = NULL;
+		pr->stamp[0] = pr->stamp[1] = 0;
+		pr->persistent = pr->active = 0;
+		return pr;
+	}
+	lock();
+	if (freeList == NULL) {
+		PendingReq* chunk = (PendingReq*) malloc(REQ_CHUNK * sizeof(PendingReq));
+		chunks.push_back(chunk);
+		memAlloc(REQ_CHUNK * sizeof(PendingReq));
+		for (int i = 0; i < REQ_CHUNK; i++) {
+			chunk[i].next = freeList;
+			freeList = &chunk[i];
+		}
+	}
+	PendingReq* pr = freeList;
+	freeList = pr->next;
+	unlock();
+	pr->next = NULL;
+	pr->ptype = MPI_DATATYPE_NULL;
+	pr->packbuf = NULL;
+	pr->stamp[0] = pr->stamp[1] = 0;
+	pr->persistent = pr->active = 0;
+	return pr;
+}
+
+void RequestTable::insert(PendingReq* pr) {
+	/* keep the load factor under 1/2 so probe sequences stay short */
+	if (2 * (used + 1) > (1u << bits)) grow();
+	unsigned mask = (1u << bits) - 1;
+	unsigned i = home(pr->request);
+	while (slots[i] != NULL) i = (i + 1) & mask;
+	slots[i] = pr;
+	used++;
+}
+
+PendingReq* RequestTable::find(MPI_Request request) {
+	if (used == 0 || request == MPI_REQUEST_NULL) return NULL;
+	unsigned mask = (1u << bits) - 1;
+	unsigned i = home(request);
+	while (slots[i] != NULL) {
+		if (slots[i]->request == request) return slots[i];
+		i = (i + 1) & mask;
+	}
+	return NULL;
+}
+
+void RequestTable::remove(PendingReq* pr) {
+	detach(pr);
+	recycle(pr);
+}
+
+/* Out of the table but never reused, for operations MPI may still be writing */
+void RequestTable::detach(PendingReq* pr) {
+	unsigned mask = (1u << bits) - 1;
+	unsigned i = home(pr->request);
+	while (slots[i] != pr) i = (i + 1) & mask;
+	/* backward shift deletion : no tombstones, lookups stay O(1) */
+	unsigned j = i;
+	slots[i] = NULL;
+	while (true) {
+		j = (j + 1) & mask;
+		if (slots[j] == NULL) break;
+		unsigned k = home(slots[j]->request);
+		if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+			slots[i] = slots[j];
+			slots[j] = NULL;
+			i = j;
+		}
+	}
+	used--;
+}
+
+void RequestTable::recycle(PendingReq* pr) {
+	if (shared) {
+		pr->next = threadFree;
+		threadFree = pr;
+		return;
+	}
+	pr->next = freeList;
+	freeList = pr;
+}
+
+unsigned RequestTable::pending() {
+	return used;
+}
+
+void RequestTable::share() {
+	shared = 1;
+}
+
+void RequestTable::lock() {
+	if (shared) pthread_mutex_lock(&mutex);
+}
+
+void RequestTable::unlock() {
+	if (shared) pthread_mutex_unlock(&mutex);
+}
+
+void initRequests(RequestTable** table) {
+	(*table) = new RequestTable();
+}
+
+PendingReq* createRequest(RequestTable* table) {
+	return table->create();
+}
+
+void insertRequest(RequestTable* table, PendingReq* pr) {
+	table->lock();
+	table->insert(pr);
+	table->unlock();
+}
+
+PendingReq* findRequest(RequestTable* table, MPI_Request request) {
+	table->lock();
+	PendingReq* pr = table->find(request);
+	table->unlock();
+	return pr;
+}
+
+void removeRequest(RequestTable* table, PendingReq* pr) {
+	table->lock();
+	table->remove(pr);
+	table->unlock();
+}
+
+void detachRequest(RequestTable* table, PendingReq* pr) {
+	table->lock();
+	table->detach(pr);
+	table->unlock();
+}
+
+void recycleRequest(RequestTable* table, PendingReq* pr) {
+	table->recycle(pr);
+}
+
+unsigned pendingRequests(RequestTable* table) {
+	return table->pending();
+}
+
+void shareRequests(RequestTable* table) {
+	table->share();
+}
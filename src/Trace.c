@@ -0,0 +1,308 @@
+#include "Trace.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+static void traceReserve(TraceBuf* tb, size_t n) {
+	if (tb->len + n <= tb->cap) return;
+	size_t cap = tb->cap ? tb->cap : 4096;
+	while (cap < tb->len + n) cap *= 2;
+	tb->data = (unsigned char*) realloc(tb->data, cap);
+	tb->cap = cap;
+}
+
+void tracePutU32(TraceBuf* tb, unsigned v) {
+	traceReserve(tb, 4);
+	tracePatchU32(tb, tb->len, v);
+	tb->len += 4;
+}
+
+void tracePatchU32(TraceBuf* tb, size_t at, unsigned v) {
+	tb->data[at] = v & 0xff;
+	tb->data[at + 1] = (v >> 8) & 0xff;
+	tb->data[at + 2] = (v >> 16) & 0xff;
+	tb->data[at + 3] = (v >> 24) & 0xff;
+}
+
+void tracePutF64(TraceBuf* tb, double v) {
+	unsigned long long bits;
+	memcpy(&bits, &v, sizeof(bits));
+	tracePutU32(tb, (unsigned) bits);
+	tracePutU32(tb, (unsigned) (bits >> 32));
+}
+
+void tracePutVarint(TraceBuf* tb, unsigned long long v) {
+	traceReserve(tb, 10);
+	while (v >= 0x80) {
+		tb->data[tb->len++] = (unsigned char) (v | 0x80);
+		v >>= 7;
+	}
+	tb->data[tb->len++] = (unsigned char) v;
+}
+
+/* listBytes is patched by traceEndLoop once the lists are encoded, returns where the block starts */
+size_t traceBeginLoop(TraceBuf* tb, int numIters, int patterns, double time) {
+	if (tb->len == 0) {
+		/* room for the file header, only written if the file is new */
+		traceReserve(tb, TRACE_HEADER);
+		memset(tb->data, 0, TRACE_HEADER);
+		tb->len = TRACE_HEADER;
+	}
+	size_t start = tb->len;
+	tracePutU32(tb, (unsigned) numIters);
+	tracePutU32(tb, (unsigned) patterns);
+	tracePutF64(tb, time);
+	tracePutU32(tb, 0);
+	tracePutU32(tb, 0);
+	return start;
+}
+
+void tracePutDelta(TraceBuf* tb, int delta) {
+	tracePutVarint(tb, ((unsigned) delta << 1) ^ (unsigned) (delta >> 31));
+}
+
+void traceEndLoop(TraceBuf* tb, size_t loopStart, size_t listStart) {
+	tracePatchU32(tb, loopStart + 16, (unsigned) (tb->len - listStart));
+}
+
+int traceAppend(TraceBuf* tb, const char* filename, int rank) {
+	int fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0) return -1;
+	struct stat st;
+	size_t off = TRACE_HEADER;
+	if (fstat(fd, &st) == 0 && st.st_size == 0) {
+		tracePatchU32(tb, 0, TRACE_MAGIC);
+		tracePatchU32(tb, 4, TRACE_VERSION);
+		tracePatchU32(tb, 8, (unsigned) rank);
+		tracePatchU32(tb, 12, 0);
+		off = 0;
+	}
+	int rt = 0;
+	while (off < tb->len) {
+		ssize_t n = write(fd, tb->data + off, tb->len - off);
+		if (n <= 0) { rt = -1; break; }
+		off += n;
+	}
+	close(fd);
+	return rt;
+}
+
+void traceFree(TraceBuf* tb) {
+	free(tb->data);
+	tb->data = NULL;
+	tb->len = tb->cap = 0;
+}
+
+static unsigned traceU32(const unsigned char* p) {
+	return (unsigned) p[0] | ((unsigned) p[1] << 8) | ((unsigned) p[2] << 16) | ((unsigned) p[3] << 24);
+}
+
+static double traceF64(const unsigned char* p) {
+	unsigned long long bits = traceU32(p) | ((unsigned long long) traceU32(p + 4) << 32);
+	double v;
+	memcpy(&v, &bits, sizeof(v));
+	return v;
+}
+
+/* 0 on success, -1 past the end or overlong */
+static int traceVarint(const unsigned char** p, const unsigned char* end, unsigned long long* v) {
+	int shift = 0;
+	*v = 0;
+	while (*p < end && shift < 64) {
+		unsigned char b = *(*p)++;
+		*v |= (unsigned long long) (b & 0x7f) << shift;
+		if (!(b & 0x80)) return 0;
+		shift += 7;
+	}
+	return -1;
+}
+
+/* Decimal integer read in place, after blanks. 0 if there is no number at *p */
+static int traceScanInt(const unsigned char** p, const unsigned char* end, int* v) {
+	const unsigned char* q = *p;
+	unsigned x = 0;
+	int neg = 0;
+	while (q < end && (*q == ' ' || *q == '\t' || *q == '\r')) q++;
+	if (q < end && *q == '-') {
+		neg = 1;
+		q++;
+	}
+	if (q == end || *q < '0' || *q > '9') {
+		*p = q;
+		return 0;
+	}
+	while (q < end && *q >= '0' && *q <= '9')
+		x = x * 10 + (*q++ - '0');
+	*v = neg ? -(int) x : (int) x;
+	*p = q;
+	return 1;
+}
+
+static const unsigned char* traceNextLine(const unsigned char* p, const unsigned char* end) {
+	const unsigned char* nl = (const unsigned char*) memchr(p, '\n', end - p);
+	return (nl == NULL) ? end : nl + 1;
+}
+
+int traceOpen(TraceFile* tf, const char* filename) {
+	struct stat st;
+	memset(tf, 0, sizeof(*tf));
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	tf->size = st.st_size;
+	if (tf->size > 0) {
+		void* map = mmap(NULL, tf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		madvise(map, tf->size, MADV_SEQUENTIAL);
+		tf->data = (const unsigned char*) map;
+	}
+	close(fd);
+	if (tf->size < TRACE_HEADER || traceU32(tf->data) != TRACE_MAGIC) {
+		tf->text = 1;
+		return 1;
+	}
+	tf->version = (int) traceU32(tf->data + 4);
+	tf->rank = (int) traceU32(tf->data + 8);
+	if (tf->version != TRACE_VERSION) {
+		traceClose(tf);
+		return -1;
+	}
+	tf->pos = TRACE_HEADER;
+	return 0;
+}
+
+void traceClose(TraceFile* tf) {
+	if (tf->data != NULL)
+		munmap((void*) tf->data, tf->size);
+	tf->data = NULL;
+	tf->size = tf->pos = 0;
+}
+
+static int traceNextTextLoop(TraceFile* tf, TraceLoop* tl) {
+	const unsigned char* p = tf->data + tf->pos;
+	const unsigned char* end = tf->data + tf->size;
+	/* whatever the caller did not read of the previous loop is skipped */
+	while (p < end && *p != '[')
+		p = traceNextLine(p, end);
+	if (p == end) {
+		tf->pos = tf->size;
+		return 0;
+	}
+	p++;
+	if (!traceScanInt(&p, end, &tl->numIters)) return -1;
+	p = traceNextLine(p, end);
+	tl->patterns = -1;
+	tl->time = 0;
+	tl->cols = NULL;
+	tl->list = p;
+	tl->end = end;
+	tl->next = 0;
+	tl->left = 0;
+	tl->file = tf;
+	tf->pos = p - tf->data;
+	return 1;
+}
+
+int traceNextLoop(TraceFile* tf, TraceLoop* tl) {
+	if (tf->text) return traceNextTextLoop(tf, tl);
+	if (tf->pos == tf->size) return 0;
+	if (tf->size - tf->pos < TRACE_LOOP_HEADER) return -1;
+	const unsigned char* p = tf->data + tf->pos;
+	tl->numIters = (int) traceU32(p);
+	tl->patterns = (int) traceU32(p + 4);
+	tl->time = traceF64(p + 8);
+	size_t listBytes = traceU32(p + 16);
+	size_t colBytes = (size_t) tl->patterns * TRACE_FIELDS * 4;
+	if (tl->patterns < 0 || tf->size - tf->pos - TRACE_LOOP_HEADER < colBytes + listBytes) return -1;
+	tl->cols = p + TRACE_LOOP_HEADER;
+	tl->list = tl->cols + colBytes;
+	tl->end = tl->list + listBytes;
+	tl->next = 0;
+	tl->left = 0;
+	tl->prev = 0;
+	tl->file = tf;
+	tf->pos += TRACE_LOOP_HEADER + colBytes + listBytes;
+	return 1;
+}
+
+static int traceNextTextPattern(TraceLoop* tl, TracePattern* tp) {
+	const unsigned char* p = tl->list;
+	const unsigned char* end = tl->end;
+	while (p < end && *p != '[' && *p != '(') {
+		if (*p == '!') {
+			/* the map is not NUL terminated, strtod gets a bounded copy */
+			char num[32];
+			size_t n = traceNextLine(p, end) - p - 1;
+			n = (n < sizeof(num) - 1) ? n : sizeof(num) - 1;
+			memcpy(num, p + 1, n);
+			num[n] = '\0';
+			tl->time = strtod(num, NULL);
+		}
+		p = traceNextLine(p, end);
+	}
+	tl->list = p;
+	tl->file->pos = p - tl->file->data;
+	if (p == end || *p == '[') {
+		tl->patterns = tl->next;
+		return 0;
+	}
+	tp->iter = p + 1;
+	p = traceNextLine(p, end);
+	tp->iterEnd = p;
+	for (int f = 0; f < TRACE_FIELDS; f++) {
+		if (!traceScanInt(&p, end, &tp->fields[f])) return -1;
+		p = traceNextLine(p, end);
+	}
+	tp->count = -1;
+	tp->loop = tl;
+	tl->list = p;
+	tl->file->pos = p - tl->file->data;
+	tl->next++;
+	return 1;
+}
+
+int traceNextPattern(TraceLoop* tl, TracePattern* tp) {
+	unsigned long long v;
+	if (tl->file->text) return traceNextTextPattern(tl, tp);
+	/* skip what the caller left of the previous list */
+	for (; tl->left > 0; tl->left--) {
+		if (traceVarint(&tl->list, tl->end, &v) < 0) return -1;
+	}
+	if (tl->next == tl->patterns) return 0;
+	for (int f = 0; f < TRACE_FIELDS; f++)
+		tp->fields[f] = (int) traceU32(tl->cols + ((size_t) f * tl->patterns + tl->next) * 4);
+	if (traceVarint(&tl->list, tl->end, &v) < 0) return -1;
+	tp->count = (int) v;
+	tp->loop = tl;
+	tl->left = tp->count;
+	tl->prev = 0;
+	tl->next++;
+	return 1;
+}
+
+int traceNextIter(TracePattern* tp, int* iter) {
+	TraceLoop* tl = tp->loop;
+	unsigned long long v;
+	if (tl->file->text) {
+		/* up to the next number of the line, ')' ends it */
+		while (tp->iter < tp->iterEnd && (*tp->iter < '0' || *tp->iter > '9') && *tp->iter != '-')
+			tp->iter++;
+		return traceScanInt(&tp->iter, tp->iterEnd, iter);
+	}
+	if (tl->left == 0) return 0;
+	if (traceVarint(&tl->list, tl->end, &v) < 0) return -1;
+	/* zigzag : iteration numbers usually grow, but nothing forces it */
+	tl->prev += (int) ((unsigned) (v >> 1) ^ (0u - (unsigned) (v & 1)));
+	tl->left--;
+	*iter = tl->prev;
+	return 1;
+}
@@ -54,6 +54,15 @@ bool Values::match(Values *other) {
 		) == 0);*/
 }
 
+/* mixes the six fields, equal signatures hash equal */
+unsigned long long Values::hash() {
+	unsigned long long h = 0;
+	int fields[6] = {numSend, numRecv, sumSrc, sumDest, xorSrc, xorDest};
+	for (int i = 0; i < 6; i++)
+		h = (h ^ (unsigned) fields[i]) * 0x100000001B3ULL + 0x9E3779B97F4A7C15ULL;
+	return h;
+}
+
 string Values::toString() {
 	ostringstream rtn;
 
@@ -3,49 +3,10 @@
 #include <stdbool.h>
 #include "string.h"
 #include "time.h"
+#include <pthread.h>
+#include <unistd.h>
+#include "Trace.h"
 
-/**/
-typedef struct iter iter;
-struct iter {
-    int index;
-    iter *next;
-};
-
-// Constructor
-iter *iter_Init(iter *iterHead) {
-	iterHead = NULL;
-	return iterHead;
-}
-
-// Destructor
-iter *iter_Finalize(iter *iterHead) {
-    iter* iterTemp;
-    while(iterHead != NULL) {
-	iterTemp = iterHead;
-        iterHead = iterHead->next;
-        iterTemp->next = NULL;
-        free(iterTemp);
-    }
-}
-
-// Add a iter to the list of iters
-iter *iter_Add(iter *iterHead, int index) {
-	if(iterHead == NULL) {
-		iterHead = malloc(sizeof(iter));
-		iterHead->index = index;
-		iterHead->next = NULL;
-	}
-	else {
-		iter *iterTemp = iterHead;
-		while(iterTemp->next != NULL) 
-			iterTemp = iterTemp->next;
-		iterTemp->next = malloc(sizeof(iter));
-        iterTemp->next->index = index;
-        iterTemp->next->next = NULL;
-	} 
-	return iterHead;
-}
-////
 
 /**/
 typedef struct {
@@ -86,6 +47,21 @@ void pattern_Update(pattern *Pattern, int index, int procIndex, int numSend, int
     Pattern[index].xorSend ^= xorSend;
     Pattern[index].xorRecv ^= xorRecv;
 }
+
+//Fold a partial pattern array into another one, sums and xors are associative
+void pattern_Merge(pattern *Pattern, pattern *Partial, int size) {
+    int i;
+    for(i = 0; i < size; i++) {
+        Pattern[i].numSend += Partial[i].numSend;
+        Pattern[i].numRecv += Partial[i].numRecv;
+        Pattern[i].sumSrc += Partial[i].sumSrc;
+        Pattern[i].sumDest += Partial[i].sumDest;
+        Pattern[i].sumRankSend += Partial[i].sumRankSend;
+        Pattern[i].sumRankRecv += Partial[i].sumRankRecv;
+        Pattern[i].xorSend ^= Partial[i].xorSend;
+        Pattern[i].xorRecv ^= Partial[i].xorRecv;
+    }
+}
 ////
 
 /**/
@@ -96,238 +72,323 @@ struct loop {
 	loop* next;
 };
 
+/* Loops in file order : a list for the verdict, a tail to append, an index to find loop k */
+typedef struct {
+	loop *head;
+	loop *tail;
+	loop **index;
+	int count;
+	int cap;
+} loopTable;
+
 //Constructor
-loop *loop_Init(loop *loopHead) {
-	loopHead = NULL;
-	return loopHead;
+void loop_Init(loopTable *loops) {
+	loops->head = loops->tail = NULL;
+	loops->index = NULL;
+	loops->count = loops->cap = 0;
 }
 
 //Destructor
-loop *loop_Finalize(loop *loopHead) {
+void loop_Finalize(loopTable *loops) {
 	loop *loopTemp;
-	while(loopHead != NULL) {
-		loopTemp = loopHead;
-		loopHead = loopHead->next;
-		loopTemp->next = NULL;
+	while(loops->head != NULL) {
+		loopTemp = loops->head;
+		loops->head = loops->head->next;
 		free(loopTemp->patternArray);
 		free(loopTemp);
 	}
-	return loopHead;
+	free(loops->index);
+	loop_Init(loops);
 }
 
 //Add a loop to the list of loops
-loop *loop_Add(loop *loopHead, int numIters) {
-	if(loopHead == NULL) {
-		loopHead = malloc(sizeof(loop));
-		loopHead->numIters = numIters;
-		loopHead->patternArray = malloc(numIters * sizeof(pattern));
-		pattern_Init(loopHead->patternArray, numIters);
-		loopHead->next = NULL;
+loop *loop_Add(loopTable *loops, int numIters) {
+	loop *loopTemp = malloc(sizeof(loop));
+	loopTemp->numIters = (numIters > 0) ? numIters : 0;
+	loopTemp->patternArray = malloc((loopTemp->numIters + 1) * sizeof(pattern));
+	pattern_Init(loopTemp->patternArray, loopTemp->numIters);
+	loopTemp->next = NULL;
+	if(loops->tail == NULL)
+		loops->head = loopTemp;
+	else
+		loops->tail->next = loopTemp;
+	loops->tail = loopTemp;
+	if(loops->count == loops->cap) {
+		loops->cap = loops->cap ? 2 * loops->cap : 16;
+		loops->index = realloc(loops->index, loops->cap * sizeof(loop*));
 	}
-	else {
-		loop *loopTemp = loopHead;
-		while(loopTemp->next != NULL) 
-			loopTemp = loopTemp->next;
-		loopTemp->next = malloc(sizeof(loop));
-		loopTemp->next->numIters = numIters;
-		loopTemp->next->patternArray = malloc(numIters * sizeof(pattern));
-		pattern_Init(loopHead->next->patternArray, numIters);
-		loopTemp->next->next = NULL;
+	loops->index[loops->count++] = loopTemp;
+	return loopTemp;
+}
+
+//Loop number loopIndex (from 1) of the traces, NULL if rank 0 had fewer loops
+loop *loop_At(loopTable *loops, int loopIndex) {
+	if(loopIndex < 1 || loopIndex > loops->count)
+		return NULL;
+	return loops->index[loopIndex - 1];
+}
+
+////
+
+//Fold the patterns of one loop of a rank trace into Pattern
+void loop_Fold(TraceLoop *tl, int procIndex, loop *loopTemp, pattern *Pattern) {
+	TracePattern tp;
+	int index;
+	while(traceNextPattern(tl, &tp) == 1) {
+		while(traceNextIter(&tp, &index) == 1) {
+			if(index >= 0 && index < loopTemp->numIters)
+				pattern_Update(Pattern, index, procIndex, tp.fields[0], tp.fields[1],
+									tp.fields[2], tp.fields[3], tp.fields[4], tp.fields[5]);
+		}
 	}
-	return loopHead;
 }
 
+/* Fold the trace of rank procIndex into the loops, rank 0 creates them.
+   With a target, loop k + 1 is folded into target[k] instead of the loop itself.
+   The file is mapped and read in place, binary or text. */
+void rank_Load(int procIndex, loopTable *loops, pattern **target) {
+	char fileName[16];
+	TraceFile tf;
+	TraceLoop tl;
+	loop *loopTemp;
+	int loopIndex = 0;
+	sprintf(fileName, "%d", procIndex);
+	if(traceOpen(&tf, fileName) < 0) {
+		fprintf(stderr, "%s : missing, unreadable or unsupported trace version\n", fileName);
+		return;
+	}
+	while(traceNextLoop(&tf, &tl) == 1) {
+		loopIndex++;
+		if(procIndex == 0)
+			loop_Add(loops, tl.numIters);
+		loopTemp = loop_At(loops, loopIndex);
+		if(loopTemp == NULL)
+			break;
+		loop_Fold(&tl, procIndex, loopTemp, (target != NULL) ? target[loopIndex - 1] : loopTemp->patternArray);
+	}
+	/* rank 0 defines the loops, without any there is no verdict to give */
+	if(procIndex == 0 && loopIndex == 0)
+		fprintf(stderr, "%s : no loop, the trace is empty or has no \"[numIters]\" line\n", fileName);
+	traceClose(&tf);
+}
 ////
 
+/* Ingestion of ranks 1..N-1 by a pool of threads. Each worker claims rank files
+   one at a time and folds them into private pattern arrays, then the partials
+   are merged pairwise in log2(workers) rounds. */
+typedef struct ingestion ingestion;
+
+typedef struct {
+    int id;
+    pattern **partial;		//partial[k] : loop k + 1
+    ingestion *in;
+    pthread_t thread;
+} worker;
+
+struct ingestion {
+    loopTable *loops;
+    int numProcs;
+    int next;			//next rank file to claim
+    int numWorkers;
+    worker *workers;
+    pthread_barrier_t barrier;
+};
+
+void *worker_Run(void *arg) {
+    worker *w = arg;
+    ingestion *in = w->in;
+    int i, k, stride;
+    while((i = __sync_fetch_and_add(&in->next, 1)) < in->numProcs)
+        rank_Load(i, in->loops, w->partial);
+    /* after the round of a given stride, worker w holds workers [w, w + 2 * stride) */
+    for(stride = 1; stride < in->numWorkers; stride *= 2) {
+        pthread_barrier_wait(&in->barrier);
+        if(w->id % (2 * stride) == 0 && w->id + stride < in->numWorkers) {
+            for(k = 0; k < in->loops->count; k++)
+                pattern_Merge(w->partial[k], in->workers[w->id + stride].partial[k], in->loops->index[k]->numIters);
+        }
+    }
+    return NULL;
+}
+
+void ingest_Parallel(loopTable *loops, int numProcs, int numWorkers) {
+    ingestion in;
+    int w, k;
+    in.loops = loops;
+    in.numProcs = numProcs;
+    in.next = 1;
+    in.numWorkers = numWorkers;
+    in.workers = calloc(numWorkers, sizeof(worker));
+    pthread_barrier_init(&in.barrier, NULL, numWorkers);
+    for(w = 0; w < numWorkers; w++) {
+        in.workers[w].id = w;
+        in.workers[w].in = &in;
+        in.workers[w].partial = malloc((loops->count + 1) * sizeof(pattern*));
+        for(k = 0; k < loops->count; k++) {
+            in.workers[w].partial[k] = malloc((loops->index[k]->numIters + 1) * sizeof(pattern));
+            pattern_Init(in.workers[w].partial[k], loops->index[k]->numIters);
+        }
+    }
+    /* every worker exists before any of them can reach the merge */
+    for(w = 0; w < numWorkers; w++)
+        pthread_create(&in.workers[w].thread, NULL, worker_Run, &in.workers[w]);
+    for(w = 0; w < numWorkers; w++)
+        pthread_join(in.workers[w].thread, NULL);
+    for(k = 0; k < loops->count; k++)
+        pattern_Merge(loops->index[k]->patternArray, in.workers[0].partial[k], loops->index[k]->numIters);
+    for(w = 0; w < numWorkers; w++) {
+        for(k = 0; k < loops->count; k++)
+            free(in.workers[w].partial[k]);
+        free(in.workers[w].partial);
+    }
+    pthread_barrier_destroy(&in.barrier);
+    free(in.workers);
+}
+
+/* Verdict of every iteration of a loop. The running totals in sum carry over
+   from the previous loops. Returns the first leaking iteration, -1 if none. */
+int loop_Verdict(loop *loopTemp, int loop_index, pattern *sum, FILE *fo) {
+	int j, first = -1;
+	printf("Loop index = %d ; numIters = %d\n", loop_index, loopTemp->numIters);
+	fprintf(fo, "Loop index = %d ; numIters = %d\n", loop_index, loopTemp->numIters);
+	for(j = 0; j < loopTemp->numIters; j++) {
+		fprintf(fo, "Iters[%d] : ", j);
+		printf("Iters[%d] : ", j);
+
+		pattern_Merge(sum, &loopTemp->patternArray[j], 1);
+
+		if (sum->numSend != sum->numRecv || sum->sumSrc != sum->sumRankSend ||
+			sum->sumDest != sum->sumRankRecv || sum->xorSend != sum->xorRecv) {
+			fprintf(fo, "Message Leaks !!!\n");
+			printf("Message Leaks !!!\n");
+			if(first < 0)
+				first = j;
+		} else {
+			fprintf(fo, "No Message leaks !!! \n");
+			printf("No Message leaks !!! \n");
+		}
+
+	    fprintf(fo, "numSend = %d\n", loopTemp->patternArray[j].numSend);
+	    fprintf(fo, "numRecv = %d\n", loopTemp->patternArray[j].numRecv);
+	    fprintf(fo, "sumSrc = %d\n", loopTemp->patternArray[j].sumSrc);
+	    fprintf(fo, "sumDest = %d\n", loopTemp->patternArray[j].sumDest);
+	    fprintf(fo, "sumRankSend = %d\n", loopTemp->patternArray[j].sumRankSend);
+	    fprintf(fo, "sumRankRecv = %d\n", loopTemp->patternArray[j].sumRankRecv);
+	    fprintf(fo, "xorSend = %d\n", loopTemp->patternArray[j].xorSend);
+	    fprintf(fo, "xorRecv = %d\n", loopTemp->patternArray[j].xorRecv);
+	}
+	fprintf(fo, "\n");
+	printf("\n");
+	return first;
+}
+
+/* Streaming mode : every rank trace stays open and advances one loop at a time,
+   so only the current loop's pattern array is in memory and the first leak is
+   reported as soon as its loop has been read */
+void stream_Verdicts(int numProcs, FILE *fo) {
+	char fileName[16];
+	TraceFile *tf = malloc(numProcs * sizeof(TraceFile));
+	int *ok = malloc(numProcs * sizeof(int));
+	TraceLoop tl;
+	pattern sum;
+	loop current;
+	int i, first, loop_index = 1, found = 0;
+	for(i = 0; i < numProcs; i++) {
+		sprintf(fileName, "%d", i);
+		ok[i] = (traceOpen(&tf[i], fileName) >= 0);
+		if(!ok[i])
+			fprintf(stderr, "%s : missing, unreadable or unsupported trace version\n", fileName);
+	}
+	pattern_Init(&sum, 1);
+	current.next = NULL;
+	/* rank 0 defines the loops */
+	while(numProcs > 0 && ok[0] && traceNextLoop(&tf[0], &tl) == 1) {
+		current.numIters = (tl.numIters > 0) ? tl.numIters : 0;
+		current.patternArray = malloc((current.numIters + 1) * sizeof(pattern));
+		pattern_Init(current.patternArray, current.numIters);
+		loop_Fold(&tl, 0, &current, current.patternArray);
+		for(i = 1; i < numProcs; i++) {
+			if(ok[i] && traceNextLoop(&tf[i], &tl) == 1)
+				loop_Fold(&tl, i, &current, current.patternArray);
+		}
+		first = loop_Verdict(&current, loop_index, &sum, fo);
+		if(first >= 0 && !found) {
+			printf("First message leak : loop %d, Iters[%d]\n", loop_index, first);
+			fprintf(fo, "First message leak : loop %d, Iters[%d]\n", loop_index, first);
+			found = 1;
+		}
+		fflush(stdout);
+		free(current.patternArray);
+		loop_index++;
+	}
+	if(numProcs > 0 && ok[0] && loop_index == 1)
+		fprintf(stderr, "0 : no loop, the trace is empty or has no \"[numIters]\" line\n");
+	for(i = 0; i < numProcs; i++) {
+		if(ok[i])
+			traceClose(&tf[i]);
+	}
+	free(ok);
+	free(tf);
+}
+
 int main(int argc, char* argv[]) {
-    int numProcs, numIters, loopIndex, i, j, begin, end, lineIndex;
-    int numSendTemp, numRecvTemp, sumSrcTemp, sumDestTemp, xorSendTemp, xorRecvTemp;
-    char fileName[8];
-    char *buffer, *strTemp;
-    iter *iterHead, *iterTemp;
+    int numProcs, numWorkers, stream = 0, i;
+    char *end;
     long start_time, end_time, elapsed;
-	loop *loopHead, *loopTemp;
+	loopTable loops;
+	loop *loopTemp;
 	
-	loopHead = loop_Init(loopHead);
+	loop_Init(&loops);
 
     start_time = clock();
-    if(argc != 2) {
+    if(argc < 2) {
         printf("Please enter number of process as first argument\n");
+        printf("then optionally the number of reading threads, or -s to stream loop by loop\n");
         return 0;
     } else {
         numProcs = atoi(argv[1]);
-    }
-
-    /*FILE * fp = fopen("iter", "r");
-    char * line = NULL;
-    size_t len = 0;
-    getline(&line, &len, fp);
-    numIters = atoi(line);
-    fclose(fp);*/
-    
-    for(i = 0; i < numProcs; i++) {
-		//!**caution: don't use "i" at anywhere in this for if you don't understand it's function**!
-        sprintf(fileName, "%d", i);
-        FILE *pFile = fopen(fileName, "r");
-        if(pFile == NULL)
-            perror("No such file exists");
-        else {
-            buffer = (char*) malloc(10000000);
-            lineIndex = 0;
-			loopIndex = 0;
-            while(fgets(buffer, 10000000, pFile) != NULL) {
-				if(buffer[0] == '[') {
-					loopIndex++;
-					if(i == 0) {
-						strTemp = (char*) malloc((strlen(buffer) - 2) * sizeof(char));
-						for(j = 1; j < strlen(buffer) - 2; j++)
-							strTemp[j - 1] = buffer[j]; 
-						strTemp[strlen(buffer) - 3] = '\0';
-						numIters = atoi(strTemp);
-						free(strTemp);
-						loopHead = loop_Add(loopHead, numIters);
-					}
-					else {}
-				}
-				else if(buffer[0] == '!') {}
-				else {
-					lineIndex++;
-					switch(lineIndex % 8) {
-					    case 0:
-					        iterTemp = iterHead;
-					        while(iterTemp != NULL) {
-								loopTemp = loopHead;
-								for(j = 0; j < loopIndex - 1; j++)
-									loopTemp = loopTemp->next;
-					            pattern_Update(loopTemp->patternArray, iterTemp->index, i, numSendTemp, numRecvTemp,
-														 sumSrcTemp, sumDestTemp, xorSendTemp, xorRecvTemp);
-					            iterTemp = iterTemp->next;
-					        }
-					        iterHead = iter_Finalize(iterHead);
-					        break;
-					    case 1:
-					        iterHead = iter_Init(iterHead);
-					        for(begin = 0; begin < strlen(buffer); begin++) {
-					            int temp = buffer[begin] - '0';
-					            if(temp >= 0 && temp <= 9) {
-					                end = begin + 1;
-					                while(buffer[end] != ' ')
-					                    end++;
-					                strTemp = (char*) malloc((end - begin + 1) * sizeof(char));
-					                for(j = begin; j < end; j++) {
-					                    strTemp[j - begin] = buffer[j];
-					                    //printf("%c", buffer[j]);
-					                }
-					                //printf("\n");
-					                strTemp[end - begin] = '\0';
-					                iterHead = iter_Add(iterHead, atoi(strTemp));
-					                free(strTemp);
-					                begin = end;
-					            }
-					        }	
-					        break;
-					    case 2:
-					        buffer[strlen(buffer) - 1] = '\0';
-					        numSendTemp = atoi(buffer);
-					        break;
-					    case 3:
-					        buffer[strlen(buffer) - 1] = '\0';
-					        numRecvTemp = atoi(buffer);
-					    break;
-					    case 4:
-					        buffer[strlen(buffer) - 1] = '\0';
-					        sumSrcTemp = atoi(buffer);
-					    break;
-					    case 5:
-					        buffer[strlen(buffer) - 1] = '\0';
-					        sumDestTemp = atoi(buffer);
-					    break;
-					    case 6:
-					        buffer[strlen(buffer) - 1] = '\0';
-					        xorSendTemp = atoi(buffer);
-					    break;
-					    case 7:
-					        buffer[strlen(buffer) - 1] = '\0';
-					        xorRecvTemp = atoi(buffer);
-					        break;
-					    default:
-					        break;
-					}
-				}
-				free(buffer);
-				buffer = (char*) malloc(10000000);
+        numWorkers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        for(i = 2; i < argc; i++) {
+            if(strcmp(argv[i], "-s") == 0) {
+                stream = 1;
+                continue;
+            }
+            numWorkers = (int) strtol(argv[i], &end, 10);
+            if(*argv[i] == '\0' || *end != '\0' || numWorkers <= 0) {
+                printf("Usage : summary numProcs [numThreads | -s]\n");
+                return 1;
             }
-            free(buffer);
         }
-		fclose(pFile);
+    }
+
+    if(!stream) {
+        /* rank 0 defines the loops, the other ranks are read in parallel.
+           Every rank must be read, whatever sysconf said */
+        rank_Load(0, &loops, NULL);
+        if(numWorkers > numProcs - 1)
+            numWorkers = numProcs - 1;
+        if(numWorkers < 1)
+            numWorkers = 1;
+        if(numProcs > 1)
+            ingest_Parallel(&loops, numProcs, numWorkers);
     }
     
     /* Testing */
-	loopTemp = loopHead;
-
-    int sNumSend = 0;
-    int sNumRecv = 0;
-    int sSumSrc = 0;
-    int sSumDest = 0;
-    int sSumRankSend = 0;
-    int sSumRankRecv = 0;
-    int sXorSend = 0;
-    int sXorRecv = 0;
-	int loop_index = 1;
 	FILE *fo = fopen("output","w");
     if (fo == NULL) {
        	printf("Error opening file !\n");
 		exit(1);
     }	
 
-	while(loopTemp != NULL) {	
-		printf("Loop index = %d ; numIters = %d\n", loop_index, loopTemp->numIters);
-		fprintf(fo, "Loop index = %d ; numIters = %d\n", loop_index, loopTemp->numIters);
-		for(j = 0; j < loopTemp->numIters; j++) {
-			fprintf(fo, "Iters[%d] : ", j);
-			printf("Iters[%d] : ", j);
-
-			sNumSend += loopTemp->patternArray[j].numSend;
-        	sNumRecv += loopTemp->patternArray[j].numRecv;
-        	sSumSrc += loopTemp->patternArray[j].sumSrc;
-        	sSumDest += loopTemp->patternArray[j].sumDest;
-        	sSumRankSend += loopTemp->patternArray[j].sumRankSend;
-        	sSumRankRecv += loopTemp->patternArray[j].sumRankRecv;
-        	sXorSend ^= loopTemp->patternArray[j].xorSend;
-        	sXorRecv ^= loopTemp->patternArray[j].xorRecv;
-
-			if (sNumSend != sNumRecv) {
-				fprintf(fo, "Message Leaks !!!\n");
-	            printf("Message Leaks !!!\n");
-    	    } else {
-    	        if (sSumSrc != sSumRankSend || sSumDest != sSumRankRecv) {
-					fprintf(fo, "Message Leaks !!!\n");
-            	    printf("Message Leaks !!!\n");
-            	} else {
-                	if (sXorSend != sXorRecv) {
-						fprintf(fo, "Message Leaks !!!\n");
-		    			printf("Message Leaks !!!\n");
-                	} else {
-						fprintf(fo, "No Message leaks !!! \n");
-                    	printf("No Message leaks !!! \n");
-                	}
-            	}
-        	}
-
-		    fprintf(fo, "numSend = %d\n", loopTemp->patternArray[j].numSend);
-		    fprintf(fo, "numRecv = %d\n", loopTemp->patternArray[j].numRecv);
-		    fprintf(fo, "sumSrc = %d\n", loopTemp->patternArray[j].sumSrc);
-		    fprintf(fo, "sumDest = %d\n", loopTemp->patternArray[j].sumDest);
-		    fprintf(fo, "sumRankSend = %d\n", loopTemp->patternArray[j].sumRankSend);
-		    fprintf(fo, "sumRankRecv = %d\n", loopTemp->patternArray[j].sumRankRecv);
-		    fprintf(fo, "xorSend = %d\n", loopTemp->patternArray[j].xorSend);
-		    fprintf(fo, "xorRecv = %d\n", loopTemp->patternArray[j].xorRecv);
-		}
-		loopTemp = loopTemp->next;
-		loop_index++;
-		fprintf(fo, "\n");
-		printf("\n");
-	}
+    if(stream) {
+        stream_Verdicts(numProcs, fo);
+    } else {
+        pattern sum;
+        int loop_index = 1;
+        pattern_Init(&sum, 1);
+        for(loopTemp = loops.head; loopTemp != NULL; loopTemp = loopTemp->next)
+            loop_Verdict(loopTemp, loop_index++, &sum, fo);
+    }
     /*int sNumSend = 0;
     int sNumRecv = 0;
     int sSumSrc = 0;
@@ -388,6 +449,6 @@ int main(int argc, char* argv[]) {
 
     
 
-    loopHead = loop_Finalize(loopHead);
+    loop_Finalize(&loops);
     return 0;
 }
@@ -0,0 +1,56 @@
+/* Root receive window : per-event cost of appending a receive and trimming the
+   window every 100 receives, for growing retained windows. The chunked RecvWindow
+   is compared with the vector front-erasure it replaces. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+#include "RecvWindow.h"
+
+#define EVENTS	2000000
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double windowCost(int retained) {
+	RecvWindow window;
+	double start = now();
+	for (int clk = 1; clk <= EVENTS; clk++) {
+		window.append(clk % 7 == 0 ? -1 : clk % 5);
+		if (clk % 100 == 0 && clk > retained)
+			window.dropTo(clk - retained);
+	}
+	return (now() - start) / EVENTS * 1e9;
+}
+
+double vectorCost(int retained, int events) {
+	vector<int> rootRecvs;
+	int increment = 0;
+	double start = now();
+	for (int clk = 1; clk <= events; clk++) {
+		rootRecvs.push_back(clk % 7 == 0 ? -1 : clk % 5);
+		if (clk % 100 == 0 && clk - retained > increment) {
+			rootRecvs.erase(rootRecvs.begin(), rootRecvs.begin() + clk - retained - increment);
+			increment = clk - retained;
+		}
+	}
+	return (now() - start) / events * 1e9;
+}
+
+int main(int argc, char **argv) {
+	int retained;
+	printf("%10s %16s %16s\n", "window", "RecvWindow ns", "vector ns");
+	for (retained = 1000; retained <= 1000000; retained *= 10) {
+		/* past 100k retained receives the vector would not finish in reasonable time */
+		if (retained <= 100000)
+			printf("%10d %16.2f %16.2f\n", retained, windowCost(retained), vectorCost(retained, EVENTS));
+		else
+			printf("%10d %16.2f %16s\n", retained, windowCost(retained), "-");
+	}
+	return 0;
+}
@@ -0,0 +1,79 @@
+/* Piggyback overhead : ping-pong bandwidth of the instrumented MPI_Send/MPI_Recv
+   against the raw PMPI_Send/PMPI_Recv. The two last ranks play ping-pong so that
+   neither of them is the root process running the deadlock analysis. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "mpi.h"
+
+#include "Misc.h"
+
+#define MAX_BYTES	(16 * 1024 * 1024)
+
+double pingpong(char *buf, int bytes, int reps, int peer, int ping, int raw) {
+	MPI_Status status;
+	int i;
+	double start = MPI_Wtime();
+	for(i = 0; i < reps; i++) {
+		if (ping) {
+			if (raw) {
+				PMPI_Send(buf, bytes, MPI_CHAR, peer, 0, MPI_COMM_WORLD);
+				PMPI_Recv(buf, bytes, MPI_CHAR, peer, 0, MPI_COMM_WORLD, &status);
+			} else {
+				MPI_Send(buf, bytes, MPI_CHAR, peer, 0, MPI_COMM_WORLD);
+				MPI_Recv(buf, bytes, MPI_CHAR, peer, 0, MPI_COMM_WORLD, &status);
+			}
+		} else {
+			if (raw) {
+				PMPI_Recv(buf, bytes, MPI_CHAR, peer, 0, MPI_COMM_WORLD, &status);
+				PMPI_Send(buf, bytes, MPI_CHAR, peer, 0, MPI_COMM_WORLD);
+			} else {
+				MPI_Recv(buf, bytes, MPI_CHAR, peer, 0, MPI_COMM_WORLD, &status);
+				MPI_Send(buf, bytes, MPI_CHAR, peer, 0, MPI_COMM_WORLD);
+			}
+		}
+	}
+	return (MPI_Wtime() - start) / (2.0 * reps);
+}
+
+int main(int argc, char **argv) {
+	int size, rank, bytes, reps, ping, pong;
+	double raw, ins;
+	char *buf;
+
+	beginning();
+	MPI_Init(&argc, &argv);
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+	if (size < 3) {
+		if (rank == 0) printf("Please run with at least 3 processes\n");
+		MPI_Finalize();
+		ending();
+		return 0;
+	}
+	ping = size - 2;
+	pong = size - 1;
+	buf = (char*) calloc(MAX_BYTES, 1);
+
+	if (rank == ping)
+		printf("%10s %14s %14s %10s\n", "bytes", "PMPI MB/s", "MPI MB/s", "overhead");
+	for(bytes = 1; bytes <= MAX_BYTES; bytes *= 4) {
+		reps = (bytes >= 1024 * 1024) ? 20 : 1000;
+		if (rank == ping || rank == pong) {
+			/* warm up both paths before timing */
+			pingpong(buf, bytes, 2, (rank == ping) ? pong : ping, rank == ping, 1);
+			pingpong(buf, bytes, 2, (rank == ping) ? pong : ping, rank == ping, 0);
+			raw = pingpong(buf, bytes, reps, (rank == ping) ? pong : ping, rank == ping, 1);
+			ins = pingpong(buf, bytes, reps, (rank == ping) ? pong : ping, rank == ping, 0);
+			if (rank == ping)
+				printf("%10d %14.2f %14.2f %9.2f%%\n", bytes, bytes / raw / 1e6, bytes / ins / 1e6,
+						(ins - raw) / raw * 100.0);
+		}
+	}
+
+	free(buf);
+	MPI_Finalize();
+	ending();
+	return 0;
+}
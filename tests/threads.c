@@ -0,0 +1,80 @@
+/* MPI_THREAD_MULTIPLE : every thread of a rank posts a nonblocking operation and
+   the next thread completes it, so in pack mode (DEADRACE_PIGGYBACK=pack) the
+   staging buffers are released by a thread other than the one that acquired them.
+   Rank 0 receives from every other rank with wildcard receives. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "mpi.h"
+
+#include "Misc.h"
+
+#define THREADS	4
+#define ITERS	500
+
+int myRank, numProcs;
+long long received;
+MPI_Request reqs[THREADS];
+int values[THREADS][ITERS];
+pthread_barrier_t posted;
+
+void* work(void *arg) {
+	int t = (int) (long) arg;
+	int i, j, peers = (myRank == 0) ? numProcs - 1 : 1;
+	int *recvs = (int*) malloc(peers * sizeof(int));
+	for (i = 0; i < ITERS; i++) {
+		values[t][i] = myRank * ITERS + i;
+		for (j = 0; j < peers; j++) {
+			if (myRank == 0)
+				MPI_Irecv(&recvs[j], 1, MPI_INT, MPI_ANY_SOURCE, t, MPI_COMM_WORLD, &reqs[t]);
+			else
+				MPI_Isend(&values[t][i], 1, MPI_INT, 0, t, MPI_COMM_WORLD, &reqs[t]);
+			pthread_barrier_wait(&posted);
+			/* the request of the previous thread */
+			MPI_Wait(&reqs[(t + THREADS - 1) % THREADS], MPI_STATUS_IGNORE);
+			pthread_barrier_wait(&posted);
+			if (myRank == 0)
+				__atomic_fetch_add(&received, recvs[j], __ATOMIC_RELAXED);
+		}
+	}
+	free(recvs);
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	int provided, t;
+	long long expected = 0;
+	pthread_t threads[THREADS];
+	double start;
+
+	beginning();
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+	MPI_Comm_size(MPI_COMM_WORLD, &numProcs);
+	MPI_Comm_rank(MPI_COMM_WORLD, &myRank);
+
+	if (provided != MPI_THREAD_MULTIPLE || numProcs < 2) {
+		if (myRank == 0) printf("Please run with at least 2 processes and MPI_THREAD_MULTIPLE\n");
+		MPI_Finalize();
+		ending();
+		return 0;
+	}
+	pthread_barrier_init(&posted, NULL, THREADS);
+	start = MPI_Wtime();
+	for (t = 0; t < THREADS; t++)
+		pthread_create(&threads[t], NULL, work, (void*) (long) t);
+	for (t = 0; t < THREADS; t++)
+		pthread_join(threads[t], NULL);
+	MPI_Barrier(MPI_COMM_WORLD);
+	if (myRank == 0) {
+		for (t = 1; t < numProcs; t++)
+			expected += THREADS * ((long long) t * ITERS * ITERS + ITERS * (ITERS - 1) / 2);
+		printf("%d threads, %d receives, %f s%s\n", THREADS, THREADS * ITERS * (numProcs - 1),
+				MPI_Wtime() - start, (received == expected) ? "" : ", WRONG DATA");
+	}
+	pthread_barrier_destroy(&posted);
+
+	MPI_Finalize();
+	ending();
+	return 0;
+}